@@ -81,10 +81,29 @@ void Build::addArgs()
     m_ap.add(
             "--dataType",
             "Data type for serialized point cloud data.  Valid values are "
-            "\"laszip\" or \"binary\".  Default: \"laszip\".\n"
+            "\"laszip\", \"binary\", \"zstandard\", or \"columnar\".  "
+            "Default: \"laszip\".\n"
             "Example: --dataType binary",
             [this](Json::Value v) { m_json["dataType"] = v.asString(); });
 
+    m_ap.add(
+            "--hierarchyType",
+            "Storage type for hierarchy files.  Valid values are \"json\" "
+            "or \"binary\".  Default: \"json\".\n"
+            "Example: --hierarchyType binary",
+            [this](Json::Value v) { m_json["hierarchyType"] = v.asString(); });
+
+    m_ap.add(
+            "--chunkStats",
+            "Dimensions for which per-chunk statistics are stored, allowing "
+            "readers to skip chunks which cannot match a filter.\n"
+            "Example: --chunkStats Classification Intensity",
+            [this](Json::Value v)
+            {
+                if (v.isArray()) m_json["chunkStats"] = v;
+                else m_json["chunkStats"].append(v.asString());
+            });
+
     m_ap.add(
             "--ticks",
             "Number of grid ticks in each spatial dimensions for data nodes.  "
@@ -180,6 +199,31 @@ void Build::addArgs()
             "entwine will determine it heuristically.",
             [this](Json::Value v) { m_json["hierarchyStep"] = extract(v); });
 
+    m_ap.add(
+            "--packThreshold",
+            "Size in bytes below which chunks are stored in pack files rather "
+            "than individually.  Default: 0 (no packing).",
+            [this](Json::Value v) { m_json["packThreshold"] = extract(v); });
+
+    m_ap.add(
+            "--packStep",
+            "Depth modulo at which pack files are split, if packing is "
+            "enabled.  Default: 4.",
+            [this](Json::Value v) { m_json["packStep"] = extract(v); });
+
+    m_ap.add(
+            "--uploadThreads",
+            "Number of threads used to upload serialized chunks.  If 0, chunks "
+            "are uploaded synchronously by the serializing thread.  "
+            "Default: 4.",
+            [this](Json::Value v) { m_json["uploadThreads"] = extract(v); });
+
+    m_ap.add(
+            "--writeBehindBytes",
+            "Maximum size in bytes of serialized chunks awaiting upload before "
+            "serialization blocks.  Default: 268435456.",
+            [this](Json::Value v) { m_json["writeBehindBytes"] = extract(v); });
+
     addArbiter();
 }
 
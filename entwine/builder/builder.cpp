@@ -21,6 +21,8 @@
 #include <entwine/builder/registry.hpp>
 #include <entwine/builder/sequence.hpp>
 #include <entwine/builder/thread-pools.hpp>
+#include <entwine/io/packer.hpp>
+#include <entwine/io/write-queue.hpp>
 #include <entwine/third/arbiter/arbiter.hpp>
 #include <entwine/third/splice-pool/splice-pool.hpp>
 #include <entwine/types/bounds.hpp>
@@ -79,6 +81,10 @@ Builder::Builder(const Config& config, OuterScope os)
     , m_resetFiles(m_config["resetFiles"].asUInt64())
 {
     prepareEndpoints();
+
+    m_metadata->writeQueue().start(
+            m_config.uploadThreads(),
+            m_config.writeBehindBytes());
 }
 
 Builder::~Builder()
@@ -134,6 +140,9 @@ void Builder::go(std::size_t max)
 
                 if (verbose())
                 {
+                    const auto q(m_metadata->writeQueue().stats());
+                    const double uploadRate(q.uploadedBytes / 1000000.0 / s);
+
                     std::cout <<
                         " T: " << commify(s) << "s" <<
                         " R: " << commify(inserts * 3600.0 / s / 1000000.0) <<
@@ -146,6 +155,9 @@ void Builder::go(std::size_t max)
                         " P: " << std::round(progress * 100.0) << "%" <<
                         " W: " << info.written <<
                         " R: " << info.read <<
+                        " Q: " << q.pending <<
+                            "(" << commify(q.pendingBytes / 1000000) << "MB)" <<
+                        " UP: " << commify(uploadRate) << "MB/s" <<
                         std::endl;
                 }
 
@@ -404,9 +416,9 @@ void Builder::save(const arbiter::Endpoint& ep)
     if (
             !m_metadata->subset() &&
             !m_metadata->hierarchyStep() &&
-            h.map().size() > heuristics::maxHierarchyNodesPerFile)
+            h.size() > heuristics::maxHierarchyNodesPerFile)
     {
-        const auto analysis(h.analyze(*m_metadata));
+        const auto analysis(h.analyze());
         for (const auto& a : analysis) a.summarize();
         const auto& chosen(*analysis.begin());
 
@@ -417,6 +429,15 @@ void Builder::save(const arbiter::Endpoint& ep)
         m_metadata->setHierarchyStep(chosen.step);
     }
 
+    if (verbose()) std::cout << "Awaiting uploads..." << std::endl;
+    m_metadata->writeQueue().await();
+
+    if (m_metadata->packer().step())
+    {
+        if (verbose()) std::cout << "Packing chunks..." << std::endl;
+        m_metadata->packer().flush(*m_out, *m_tmp);
+    }
+
     if (verbose()) std::cout << "Saving registry..." << std::endl;
     m_registry->save(*m_out);
 
@@ -456,6 +477,13 @@ void Builder::prepareEndpoints()
             {
                 throw std::runtime_error("Couldn't create hierarchy directory");
             }
+
+            if (
+                    m_metadata->packer().step() &&
+                    !arbiter::fs::mkdirp(rootDir + "p"))
+            {
+                throw std::runtime_error("Couldn't create pack directory");
+            }
         }
     }
 }
@@ -11,6 +11,8 @@
 #include <entwine/builder/chunk.hpp>
 
 #include <entwine/io/io.hpp>
+#include <entwine/types/binary-point-table.hpp>
+#include <entwine/types/chunk-stats.hpp>
 
 namespace entwine
 {
@@ -19,6 +21,29 @@ namespace
 {
     std::mutex m;
     ReffedChunk::Info info;
+
+    ChunkStats makeStats(const Metadata& m, const Cell::PooledStack& cells)
+    {
+        ChunkStats stats;
+        if (m.chunkStats().empty()) return stats;
+
+        BinaryPointTable table(m.schema());
+        const pdal::PointRef& pr(table.ref());
+
+        for (const Cell& cell : cells)
+        {
+            for (const char* data : cell)
+            {
+                table.setPoint(data);
+                for (const auto id : m.chunkStats())
+                {
+                    stats[id].add(pr.getFieldAs<double>(id));
+                }
+            }
+        }
+
+        return stats;
+    }
 }
 
 ReffedChunk::ReffedChunk(
@@ -130,6 +155,9 @@ void ReffedChunk::unref(const Origin o)
             CountedCells cells(m_chunk->acquire());
 
             m_hierarchy.set(m_key.get(), cells.np);
+            m_hierarchy.setStats(
+                    m_key.get(),
+                    makeStats(m_metadata, cells.stack));
 
             m_metadata.dataIo().write(
                     m_out,
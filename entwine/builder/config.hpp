@@ -103,7 +103,15 @@ public:
     }
 
     std::string dataType() const { return m_json["dataType"].asString(); }
-    std::string hierType() const { return m_json["hierarchyType"].asString(); }
+    std::string hierType() const
+    {
+        if (m_json.isMember("hierarchyType"))
+        {
+            return m_json["hierarchyType"].asString();
+        }
+        else return "json";
+    }
+    const Json::Value& chunkStats() const { return m_json["chunkStats"]; }
 
     const Json::Value& json() const { return m_json; }
     Json::Value& json() { return m_json; }
@@ -158,6 +166,32 @@ public:
     {
         return m_json["hierarchyStep"].asUInt64();
     }
+    uint64_t packThreshold() const
+    {
+        return m_json["packThreshold"].asUInt64();
+    }
+    uint64_t packStep() const
+    {
+        if (m_json.isMember("packStep")) return m_json["packStep"].asUInt64();
+        else if (packThreshold()) return heuristics::packStep;
+        else return 0;
+    }
+    std::size_t uploadThreads() const
+    {
+        if (m_json.isMember("uploadThreads"))
+        {
+            return m_json["uploadThreads"].asUInt64();
+        }
+        else return heuristics::uploadThreads;
+    }
+    uint64_t writeBehindBytes() const
+    {
+        if (m_json.isMember("writeBehindBytes"))
+        {
+            return m_json["writeBehindBytes"].asUInt64();
+        }
+        else return heuristics::writeBehindBytes;
+    }
 
     std::string srs() const { return m_json["srs"].asString(); }
     std::string postfix() const
@@ -10,6 +10,9 @@
 
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+
 namespace entwine
 {
 namespace heuristics
@@ -32,6 +35,38 @@ const float defaultWorkToClipRatio(0.33);
 // Max number of nodes to store in a single hierarchy file.
 const std::size_t maxHierarchyNodesPerFile(65536);
 
+// If the hierarchy must be split, each step in this range is considered.
+const uint64_t minHierarchyStep(5);
+const uint64_t maxHierarchyStep(10);
+
+// If chunk packing is enabled without an explicit step, each pack holds the
+// small chunks of a subtree this many levels deep.
+const std::size_t packStep(4);
+
+// Pack indexes are cached up to this many bytes in memory.
+const std::size_t packIndexBytes(64 * 1024 * 1024);
+
+// If enabled, serialized chunks are uploaded by a dedicated pool of this many
+// threads, which may fall behind the encoding threads by up to this many bytes
+// before the encoders block.  By default, each chunk is uploaded by the thread
+// which serialized it, so upload errors are raised where they occur.
+const std::size_t uploadThreads(0);
+const uint64_t writeBehindBytes(256 * 1024 * 1024);
+
+// The reader cache holds decoded chunks up to the first size, and the stored
+// bytes of compressed chunks up to the second, which together make up a
+// gigabyte by default.  With compression ratios of around four or more, the
+// smaller second tier still covers more chunks than the first.
+const std::size_t cacheBytes(768 * 1024 * 1024);
+const std::size_t cacheCompressedBytes(256 * 1024 * 1024);
+
+// Queries prefetch up to this many chunks beyond the one being processed, by
+// a pool of this many threads per reader, but never more than this fraction
+// of the reader cache.
+const std::size_t prefetchChunks(16);
+const std::size_t prefetchThreads(4);
+const double prefetchCacheRatio(0.25);
+
 } // namespace heuristics
 } // namespace entwine
 
@@ -10,6 +10,10 @@
 
 #include <entwine/builder/hierarchy.hpp>
 
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+
 #include <entwine/io/ensure.hpp>
 #include <entwine/types/metadata.hpp>
 #include <entwine/util/json.hpp>
@@ -17,6 +21,225 @@
 namespace entwine
 {
 
+namespace
+{
+    // A key is packed as a leading 1 bit at position 3D, followed by the
+    // D-bit X, Y, and Z values.  Zero is never a valid packed key, so it marks
+    // empty slots.
+    const uint64_t maxPackedDepth(21);
+    const uint64_t empty(0);
+
+    bool packable(const Dxyz& k) { return k.d <= maxPackedDepth; }
+
+    uint64_t pack(const Dxyz& k)
+    {
+        const uint64_t d(k.d);
+        return (1ULL << (3 * d)) |
+            (k.p.x << (2 * d)) |
+            (k.p.y << d) |
+            k.p.z;
+    }
+
+    Dxyz unpack(const uint64_t v)
+    {
+        uint64_t msb(0);
+        while (v >> (msb + 1)) ++msb;
+
+        const uint64_t d(msb / 3);
+        const uint64_t mask((1ULL << d) - 1);
+        return Dxyz(d, (v >> (2 * d)) & mask, (v >> d) & mask, v & mask);
+    }
+
+    uint64_t mix(uint64_t v)
+    {
+        v ^= v >> 33;
+        v *= 0xff51afd7ed558ccdULL;
+        v ^= v >> 33;
+        v *= 0xc4ceb9fe1a85ec53ULL;
+        v ^= v >> 33;
+        return v;
+    }
+
+    // The root of the hierarchy file in which this node resides for the given
+    // step.  Nodes at stepped depths reside in their parent file.
+    Dxyz resident(const Dxyz& k, const uint64_t step)
+    {
+        if (k.d <= step) return Dxyz();
+
+        const uint64_t d((k.d - 1) / step * step);
+        const uint64_t shift(k.d - d);
+        return Dxyz(d, k.p.x >> shift, k.p.y >> shift, k.p.z >> shift);
+    }
+} // unnamed namespace
+
+void Hierarchy::set(const Dxyz& key, const uint64_t val)
+{
+    if (assign(key, val) && m_tracking) touch(key);
+}
+
+bool Hierarchy::assign(const Dxyz& key, const uint64_t val)
+{
+    if (!packable(key))
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it(m_deep.find(key));
+        if (it != m_deep.end() && it->second == val) return false;
+        m_deep[key] = val;
+        return true;
+    }
+
+    const uint64_t k(pack(key));
+    Shard& s(shard(k));
+
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (uint64_t* v = s.find(k))
+    {
+        if (*v == val) return false;
+        *v = val;
+        return true;
+    }
+
+    if ((s.size + 1) * 2 > s.keys.size()) s.grow();
+
+    std::size_t i(mix(k) & (s.keys.size() - 1));
+    while (s.keys[i] != empty) i = (i + 1) & (s.keys.size() - 1);
+
+    s.keys[i] = k;
+    s.vals[i] = val;
+    ++s.size;
+    return true;
+}
+
+void Hierarchy::touch(const Dxyz& key)
+{
+    std::lock_guard<std::mutex> lock(m_dirtyMutex);
+
+    if (!m_step) m_dirty.insert(Dxyz());
+    else
+    {
+        m_dirty.insert(resident(key, m_step));
+        if (key.d && key.d % m_step == 0) m_dirty.insert(key);
+    }
+}
+
+void Hierarchy::setStats(const Dxyz& key, ChunkStats stats)
+{
+    if (stats.empty()) return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_statsMutex);
+        m_stats[key] = std::move(stats);
+    }
+
+    if (m_tracking) touch(key);
+}
+
+ChunkStats Hierarchy::stats(const Dxyz& key) const
+{
+    std::lock_guard<std::mutex> lock(m_statsMutex);
+    auto it(m_stats.find(key));
+    if (it == m_stats.end()) return ChunkStats();
+    else return it->second;
+}
+
+uint64_t Hierarchy::get(const Dxyz& key) const
+{
+    if (!packable(key))
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it(m_deep.find(key));
+        if (it == m_deep.end()) return 0;
+        else return it->second;
+    }
+
+    const uint64_t k(pack(key));
+    Shard& s(shard(k));
+
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (const uint64_t* v = s.find(k)) return *v;
+    else return 0;
+}
+
+Hierarchy::Map Hierarchy::map() const
+{
+    Map result;
+    each([&result](const Dxyz& k, const uint64_t n) { result[k] = n; });
+    return result;
+}
+
+void Hierarchy::each(
+        const std::function<void(const Dxyz&, uint64_t)>& f) const
+{
+    for (const Shard& s : m_shards)
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        for (std::size_t i(0); i < s.keys.size(); ++i)
+        {
+            if (s.keys[i] != empty) f(unpack(s.keys[i]), s.vals[i]);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const auto& p : m_deep) f(p.first, p.second);
+}
+
+std::size_t Hierarchy::size() const
+{
+    std::size_t result(0);
+
+    for (const Shard& s : m_shards)
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        result += s.size;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return result + m_deep.size();
+}
+
+Hierarchy::Shard& Hierarchy::shard(const uint64_t key) const
+{
+    // Use the high bits for the shard, since the low bits select the slot.
+    return m_shards[(mix(key) >> 58) % m_shards.size()];
+}
+
+uint64_t* Hierarchy::Shard::find(const uint64_t key)
+{
+    if (keys.empty()) return nullptr;
+
+    std::size_t i(mix(key) & (keys.size() - 1));
+    while (keys[i] != empty)
+    {
+        if (keys[i] == key) return &vals[i];
+        i = (i + 1) & (keys.size() - 1);
+    }
+
+    return nullptr;
+}
+
+void Hierarchy::Shard::grow()
+{
+    const std::vector<uint64_t> oldKeys(std::move(keys));
+    const std::vector<uint64_t> oldVals(std::move(vals));
+
+    keys.assign(std::max<std::size_t>(oldKeys.size() * 2, 64), empty);
+    vals.assign(keys.size(), 0);
+
+    const std::size_t mask(keys.size() - 1);
+
+    for (std::size_t o(0); o < oldKeys.size(); ++o)
+    {
+        const uint64_t k(oldKeys[o]);
+        if (k == empty) continue;
+
+        std::size_t i(mix(k) & mask);
+        while (keys[i] != empty) i = (i + 1) & mask;
+
+        keys[i] = k;
+        vals[i] = oldVals[o];
+    }
+}
+
 Hierarchy::Hierarchy(
         const Metadata& m,
         const arbiter::Endpoint& top,
@@ -26,6 +249,11 @@ Hierarchy::Hierarchy(
     {
         const arbiter::Endpoint ep(top.getSubEndpoint("h"));
         load(m, ep);
+
+        // From here on, track which of the existing files are modified so
+        // only those are rewritten.
+        m_step = m.hierarchyStep();
+        m_tracking = true;
     }
 }
 
@@ -34,14 +262,30 @@ void Hierarchy::load(
         const arbiter::Endpoint& ep,
         const Dxyz& root)
 {
-    const auto json(parse(ep.get(filename(m, root))));
+    const auto file(
+            HierarchyFile::load(m.hierarchyType(), ep, basename(m, root)));
 
-    for (const auto s : json.getMemberNames())
+    // Statistics may be missing if they were not enabled by a previous run,
+    // in which case they are recorded from here on as chunks are written.
+    if (!m.chunkStats().empty())
     {
-        const Dxyz k(s);
-        assert(!m_map.count(k) || m_map.at(k) == json[s].asUInt64());
+        if (const auto data = ep.tryGet(statsFilename(m, root)))
+        {
+            const Json::Value json(parse(*data));
+            for (const std::string& k : json.getMemberNames())
+            {
+                setStats(Dxyz(k), toChunkStats(json[k], m.schema()));
+            }
+        }
+    }
+
+    for (std::size_t i(0); i < file->size(); ++i)
+    {
+        const Dxyz k(file->key(i));
+        const uint64_t n(file->count(i));
+        assert(!get(k) || get(k) == n);
 
-        m_map[k] = json[s].asUInt64();
+        set(k, n);
 
         if (
                 m.hierarchyStep() &&
@@ -59,101 +303,137 @@ void Hierarchy::save(
         Pool& pool) const
 {
     const arbiter::Endpoint ep(top.getSubEndpoint("h"));
+    const uint64_t step(m.hierarchyStep());
 
-    Json::Value json;
-    const ChunkKey k(m);
-    save(m, ep, pool, k, json);
+    // If we've loaded an existing hierarchy whose layout is unchanged, then
+    // only the files containing modified nodes need to be written.
+    const bool incremental(m_tracking && step == m_step);
 
-    const std::string f(filename(m, k));
-    pool.add([&ep, f, json]() { ensurePut(ep, f, json.toStyledString()); });
+    std::set<Dxyz> dirty;
+    if (incremental)
+    {
+        std::lock_guard<std::mutex> lock(m_dirtyMutex);
+        dirty = m_dirty;
+    }
 
-    pool.cycle();
-}
+    // Group the nodes by the file in which they reside, keyed by the root of
+    // each file.  The root of each split file is also duplicated in its parent.
+    using Records = std::vector<HierarchyFile::Record>;
+    std::map<Dxyz, std::shared_ptr<Records>> files;
+    if (!incremental || dirty.count(Dxyz()))
+    {
+        files[Dxyz()] = std::make_shared<Records>();
+    }
 
-void Hierarchy::save(
-        const Metadata& m,
-        const arbiter::Endpoint& ep,
-        Pool& pool,
-        const ChunkKey& k,
-        Json::Value& curr) const
-{
-    const uint64_t n(get(k.dxyz()));
-    if (!n) return;
+    auto add([&files, incremental, &dirty](
+                const Dxyz& root,
+                const Dxyz& k,
+                uint64_t n)
+    {
+        if (incremental && !dirty.count(root)) return;
 
-    curr[k.toString()] = static_cast<Json::UInt64>(n);
+        auto& records(files[root]);
+        if (!records) records = std::make_shared<Records>();
+        records->emplace_back(k, n);
+    });
 
-    if (m.hierarchyStep() && k.depth() && (k.depth() % m.hierarchyStep() == 0))
+    each([step, &add](const Dxyz& k, const uint64_t n)
     {
-        Json::Value next;
-        next[k.toString()] = static_cast<Json::UInt64>(n);
+        if (!n) return;
 
-        for (uint64_t dir(0); dir < 8; ++dir)
+        if (!step) add(Dxyz(), k, n);
+        else
         {
-            save(m, ep, pool, k.getStep(toDir(dir)), next);
+            add(resident(k, step), k, n);
+            if (k.d && k.d % step == 0) add(k, k, n);
         }
+    });
 
-        const std::string f(filename(m, k));
-        pool.add([&ep, f, next]() { ensurePut(ep, f, toFastString(next)); });
-    }
-    else
+    // Chunk statistics are written alongside each hierarchy file, for the
+    // nodes residing in that file.
+    std::map<Dxyz, std::shared_ptr<Json::Value>> stats;
+    if (!m.chunkStats().empty())
     {
-        for (uint64_t dir(0); dir < 8; ++dir)
+        for (const auto& p : files)
         {
-            save(m, ep, pool, k.getStep(toDir(dir)), curr);
+            stats[p.first] = std::make_shared<Json::Value>(Json::objectValue);
+        }
+
+        std::lock_guard<std::mutex> lock(m_statsMutex);
+        for (const auto& p : m_stats)
+        {
+            const Dxyz& k(p.first);
+            const auto it(stats.find(step ? resident(k, step) : Dxyz()));
+            if (it == stats.end()) continue;
+
+            (*it->second)[k.toString()] = toJson(p.second, m.schema());
         }
     }
-}
 
-Hierarchy::AnalysisSet Hierarchy::analyze(const Metadata& m) const
-{
-    AnalysisSet result;
-    std::vector<uint64_t> steps{ 5, 6, 8, 10 };
-    for (const uint64_t step : steps)
+    const std::string type(m.hierarchyType());
+
+    for (const auto& p : files)
     {
-        Map analyzed;
-        const ChunkKey k(m);
-        analyzed[k.dxyz()] = 1;
-        analyze(m, step, k, k.dxyz(), analyzed);
+        const std::string f(filename(m, p.first));
+        const std::shared_ptr<Records> records(p.second);
 
-        result.emplace(m_map, analyzed, step);
+        pool.add([&ep, type, f, records]()
+        {
+            ensurePut(ep, f, HierarchyFile::serialize(type, *records));
+        });
     }
 
-    return result;
+    for (const auto& p : stats)
+    {
+        const std::string f(statsFilename(m, p.first));
+        const std::shared_ptr<Json::Value> json(p.second);
+
+        pool.add([&ep, f, json]() { ensurePut(ep, f, toFastString(*json)); });
+    }
+
+    pool.cycle();
+
+    std::lock_guard<std::mutex> lock(m_dirtyMutex);
+    for (const Dxyz& root : dirty) m_dirty.erase(root);
 }
 
-void Hierarchy::analyze(
-    const Metadata& m,
-    const uint64_t step,
-    const ChunkKey& k,
-    const Dxyz& curr,
-    Hierarchy::Map& map) const
+Hierarchy::AnalysisSet Hierarchy::analyze(
+        const uint64_t minStep,
+        const uint64_t maxStep) const
 {
-    const uint64_t n(get(k.dxyz()));
-    if (!n) return;
+    if (!minStep || minStep > maxStep)
+    {
+        throw std::runtime_error("Invalid hierarchy step range");
+    }
 
-    ++map[curr];
+    // For each step, the node count of each resulting file, keyed by the root
+    // of that file.  Nodes at stepped depths are counted both in the file in
+    // which they reside and as the root of their own file.
+    std::vector<Map> files(maxStep - minStep + 1);
+    for (Map& f : files) f[Dxyz()] = 0;
 
-    if (step && k.depth() && (k.depth() % step == 0))
+    each([&files, minStep, maxStep](const Dxyz& k, const uint64_t n)
     {
-        const Dxyz next(k.dxyz());
-        map[next] = 1;
+        if (!n) return;
 
-        for (uint64_t dir(0); dir < 8; ++dir)
+        for (uint64_t step(minStep); step <= maxStep; ++step)
         {
-            analyze(m, step, k.getStep(toDir(dir)), next, map);
+            Map& f(files[step - minStep]);
+            ++f[resident(k, step)];
+            if (k.d && k.d % step == 0) ++f[k];
         }
-    }
-    else
+    });
+
+    AnalysisSet result;
+    for (uint64_t step(minStep); step <= maxStep; ++step)
     {
-        for (uint64_t dir(0); dir < 8; ++dir)
-        {
-            analyze(m, step, k.getStep(toDir(dir)), curr, map);
-        }
+        result.emplace(files[step - minStep], step);
     }
+
+    return result;
 }
 
 Hierarchy::Analysis::Analysis(
-        const Hierarchy::Map& hierarchy,
         const Hierarchy::Map& analyzed,
         uint64_t step)
     : step(step)
@@ -10,12 +10,18 @@
 
 #pragma once
 
+#include <array>
+#include <cstdint>
+#include <functional>
 #include <map>
 #include <mutex>
 #include <set>
+#include <vector>
 
 #include <entwine/builder/heuristics.hpp>
+#include <entwine/io/hierarchy-file.hpp>
 #include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/types/chunk-stats.hpp>
 #include <entwine/types/key.hpp>
 #include <entwine/util/pool.hpp>
 
@@ -24,6 +30,10 @@ namespace entwine
 
 class Metadata;
 
+// Node counts are stored in open-addressed hash tables keyed by a packed
+// 64-bit representation of each node's key, sharded by that key so that
+// concurrent clip threads rarely contend.  Nodes too deep to be packed fall
+// back to a single ordered map.
 class Hierarchy
 {
 public:
@@ -34,7 +44,7 @@ public:
     {
         for (const auto key : json.getMemberNames())
         {
-            m_map[Dxyz(key)] = json[key].asUInt64();
+            set(Dxyz(key), json[key].asUInt64());
         }
     }
 
@@ -43,33 +53,30 @@ public:
             const arbiter::Endpoint& top,
             bool exists);
 
-    void set(const Dxyz& key, uint64_t val)
-    {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        auto it(m_map.find(key));
-        if (it == m_map.end()) m_map[key] = val;
-        else it->second = val;
-    }
+    void set(const Dxyz& key, uint64_t val);
+    uint64_t get(const Dxyz& key) const;
 
-    uint64_t get(const Dxyz& key) const
-    {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        auto it(m_map.find(key));
-        if (it == m_map.end()) return 0;
-        else return it->second;
-    }
+    // Attribute statistics for the chunk at this key, for the dimensions
+    // selected by the "chunkStats" setting.  These are stored alongside the
+    // hierarchy so that readers may skip chunks which cannot match a filter.
+    void setStats(const Dxyz& key, ChunkStats stats);
+    ChunkStats stats(const Dxyz& key) const;
 
     Json::Value toJson() const
     {
         Json::Value json;
-        for (const auto& p : m_map)
+        for (const auto& p : map())
         {
             json[p.first.toString()] = (Json::UInt64)p.second;
         }
         return json;
     }
 
-    const Map& map() const { return m_map; }
+    // A sorted snapshot of the current contents.  This is relatively
+    // expensive, so it should only be used when saving or merging.
+    Map map() const;
+
+    std::size_t size() const;
 
     void save(
             const Metadata& metadata,
@@ -79,7 +86,7 @@ public:
     struct Analysis
     {
         Analysis() { }
-        Analysis(const Map& hierarchy, const Map& analyzed, uint64_t step);
+        Analysis(const Map& analyzed, uint64_t step);
 
         uint64_t step = 0;
         uint64_t totalFiles = 0;
@@ -89,7 +96,10 @@ public:
         double stddev = 0;
         double rsd = 0;
 
-        bool fits() const { return maxNodesPerFile <= 65536; }
+        bool fits() const
+        {
+            return maxNodesPerFile <= heuristics::maxHierarchyNodesPerFile;
+        }
 
         void summarize() const;
         bool operator<(const Analysis& b) const;
@@ -97,17 +107,29 @@ public:
 
     using AnalysisSet = std::set<Analysis>;
 
-    AnalysisSet analyze(const Metadata& m) const;
+    // Analyze the resulting hierarchy file layout for each step in the range
+    // [minStep, maxStep], in a single pass over the nodes.  Each node is
+    // counted once in the file in which it resides, and nodes at stepped
+    // depths are counted again as the root of their own file.
+    AnalysisSet analyze(
+            uint64_t minStep = heuristics::minHierarchyStep,
+            uint64_t maxStep = heuristics::maxHierarchyStep) const;
 
 private:
+    std::string basename(const Metadata& m, const Dxyz& dxyz) const
+    {
+        return dxyz.toString() + m.postfix();
+    }
+
     std::string filename(const Metadata& m, const Dxyz& dxyz) const
     {
-        return dxyz.toString() + m.postfix() + ".json";
+        return basename(m, dxyz) +
+            HierarchyFile::extension(m.hierarchyType());
     }
 
-    std::string filename(const Metadata& m, const ChunkKey& k) const
+    std::string statsFilename(const Metadata& m, const Dxyz& dxyz) const
     {
-        return filename(m, k.dxyz());
+        return basename(m, dxyz) + ".stats.json";
     }
 
     void load(
@@ -115,22 +137,43 @@ private:
             const arbiter::Endpoint& endpoint,
             const Dxyz& key = Dxyz());
 
-    void save(
-            const Metadata& metadata,
-            const arbiter::Endpoint& endpoint,
-            Pool& pool,
-            const ChunkKey& key,
-            Json::Value& json) const;
+    // Returns true if this value was changed.
+    bool assign(const Dxyz& key, uint64_t val);
+
+    // Mark the files containing this node as modified.
+    void touch(const Dxyz& key);
+
+    // Visit every node, in no particular order.
+    void each(const std::function<void(const Dxyz&, uint64_t)>& f) const;
 
-    void analyze(
-            const Metadata& m,
-            uint64_t step,
-            const ChunkKey& key,
-            const Dxyz& curr,
-            Map& map) const;
+    struct Shard
+    {
+        uint64_t* find(uint64_t key);
+        void grow();
+
+        mutable std::mutex mutex;
+        std::vector<uint64_t> keys;
+        std::vector<uint64_t> vals;
+        std::size_t size = 0;
+    };
+
+    Shard& shard(uint64_t key) const;
+
+    mutable std::array<Shard, 64> m_shards;
 
     mutable std::mutex m_mutex;
-    Map m_map;
+    Map m_deep;
+
+    mutable std::mutex m_statsMutex;
+    std::map<Dxyz, ChunkStats> m_stats;
+
+    // For continued builds, the roots of the hierarchy files, split at the
+    // existing step, which have been modified since they were loaded.
+    bool m_tracking = false;
+    uint64_t m_step = 0;
+
+    mutable std::mutex m_dirtyMutex;
+    mutable std::set<Dxyz> m_dirty;
 };
 
 } // namespace entwine
@@ -84,6 +84,7 @@ void Registry::merge(const Registry& other, Clipper& clipper)
         {
             assert(!m_hierarchy.get(dxyz));
             m_hierarchy.set(dxyz, np);
+            m_hierarchy.setStats(dxyz, other.hierarchy().stats(dxyz));
         }
     }
 }
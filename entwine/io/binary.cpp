@@ -12,7 +12,9 @@
 
 #include <pdal/PointRef.hpp>
 
+#include <entwine/io/mapped-file.hpp>
 #include <entwine/types/binary-point-table.hpp>
+#include <entwine/types/point-sort.hpp>
 #include <entwine/util/executor.hpp>
 
 namespace entwine
@@ -26,7 +28,7 @@ void Binary::write(
         Cell::PooledStack&& cells,
         const uint64_t np) const
 {
-    writeBuffer(out, filename + ".bin", getBuffer(cells, np));
+    writeBuffer(out, tmp, filename + ".bin", getBuffer(cells, np));
     pointPool.release(std::move(cells));
 }
 
@@ -36,7 +38,51 @@ Cell::PooledStack Binary::read(
         PointPool& pool,
         const std::string& filename) const
 {
-    return getCells(pool, getBuffer(out, filename + ".bin"));
+    const std::string basename(filename + extension());
+
+    if (!compressed() && out.isLocal() && pool.readOnly())
+    {
+        std::shared_ptr<MappedFile> file(
+                MappedFile::create(out.prefixedRoot() + basename));
+
+        if (file)
+        {
+            const uint64_t pointSize(m_metadata.schema().pointSize());
+            if (file->size() % pointSize)
+            {
+                throw std::runtime_error("Invalid binary size: " + basename);
+            }
+
+            char* data(file->data());
+            const uint64_t np(file->size() / pointSize);
+
+            // Only the full native schema may reference the file in place.
+            if (pool.schema() != m_metadata.schema())
+            {
+                return getCells(pool, data, np);
+            }
+
+            return getCells(
+                    pool,
+                    pool.dataPool().acquireExternal(data, np, std::move(file)));
+        }
+    }
+
+    return DataIo::read(out, tmp, pool, filename);
+}
+
+Cell::PooledStack Binary::decode(
+        PointPool& pool,
+        const std::string& filename,
+        const std::vector<char>& data) const
+{
+    const uint64_t pointSize(m_metadata.schema().pointSize());
+    if (data.size() % pointSize)
+    {
+        throw std::runtime_error("Invalid binary size: " + filename);
+    }
+
+    return getCells(pool, data.data(), data.size() / pointSize);
 }
 
 std::vector<char> Binary::getBuffer(
@@ -47,9 +93,6 @@ std::vector<char> Binary::getBuffer(
     const uint64_t ps(m_metadata.schema().pointSize());
     buffer.reserve(np * ps);
 
-    using DimId = pdal::Dimension::Id;
-
-    BinaryPointTable ta(m_metadata.schema()), tb(m_metadata.schema());
     std::vector<Ref> refs;
     refs.reserve(np);
     for (const Cell& cell : cells)
@@ -62,21 +105,7 @@ std::vector<char> Binary::getBuffer(
 
     assert(refs.size() == np);
 
-    std::sort(
-            refs.begin(),
-            refs.end(),
-            [&ta, &tb, ps](const Ref& a, const Ref& b)
-            {
-                ta.setPoint(a.data());
-                tb.setPoint(b.data());
-
-                double ga(ta.ref().getFieldAs<double>(DimId::GpsTime));
-                double gb(tb.ref().getFieldAs<double>(DimId::GpsTime));
-
-                return
-                    (ga < gb) ||
-                    (ga == gb && std::memcmp(a.data(), b.data(), ps) < 0);
-            });
+    sortByTime(refs, m_metadata.schema());
 
     for (const Ref& ref : refs)
     {
@@ -88,40 +117,110 @@ std::vector<char> Binary::getBuffer(
 
 Cell::PooledStack Binary::getCells(
         PointPool& pool,
-        const std::vector<char>& buffer) const
+        const char* buffer,
+        const uint64_t np) const
 {
-    const uint64_t pointSize(m_metadata.schema().pointSize());
-    const uint64_t np(buffer.size() / pointSize);
+    const Schema& native(m_metadata.schema());
+    const Schema& schema(pool.schema());
+    const uint64_t pointSize(native.pointSize());
 
-    assert(buffer.size() % pointSize == 0);
+    Data::PooledStack dataStack(acquire(pool, np));
 
-    Cell::PooledStack cellStack(pool.cellPool().acquire(np));
-    Data::PooledStack dataStack(pool.dataPool().acquire(np));
+    if (schema != native)
+    {
+        // Each dimension is a contiguous run of bytes in both layouts, so
+        // copy those runs for the dimensions we want, and skip the rest.
+        struct Run
+        {
+            std::size_t from;
+            std::size_t to;
+            std::size_t size;
+        };
 
-    BinaryPointTable table(m_metadata.schema());
-    pdal::PointRef pr(table, 0);
+        std::vector<Run> runs;
+        for (const DimInfo& dim : schema.dims())
+        {
+            const DimInfo& from(native.find(dim.name()));
 
-    const char* end(buffer.data() + buffer.size());
+            Run run;
+            run.from = native.pdalLayout().dimDetail(from.id())->offset();
+            run.to = schema.pdalLayout().dimDetail(dim.id())->offset();
+            run.size = dim.size();
+            runs.push_back(run);
+        }
 
-    Cell::RawNode* cell(cellStack.head());
+        const char* pos(buffer);
+        for (char* data : dataStack)
+        {
+            for (const Run& r : runs)
+            {
+                std::copy(pos + r.from, pos + r.from + r.size, data + r.to);
+            }
+            pos += pointSize;
+        }
+    }
+    else if (char* dst = contiguous(dataStack))
+    {
+        std::copy(buffer, buffer + np * pointSize, dst);
+    }
+    else
+    {
+        const char* pos(buffer);
+        for (char* data : dataStack)
+        {
+            std::copy(pos, pos + pointSize, data);
+            pos += pointSize;
+        }
+    }
+
+    return getCells(pool, std::move(dataStack));
+}
+
+Cell::PooledStack Binary::getCells(
+        PointPool& pool,
+        Data::PooledStack dataStack) const
+{
+    Cell::PooledStack cellStack(pool.cellPool().acquire(dataStack.size()));
 
-    for (const char* pos(buffer.data()); pos < end; pos += pointSize)
+    BinaryPointTable table(pool.schema());
+    pdal::PointRef pr(table, 0);
+
+    for (Cell& cell : cellStack)
     {
-        assert(dataStack.size());
+        assert(!dataStack.empty());
         auto data(dataStack.popOne());
-        std::copy(pos, pos + pointSize, *data);
         table.setPoint(*data);
-
-        assert(cell);
-        cell->val().set(pr, std::move(data));
-        cell = cell->next();
+        cell.set(pr, std::move(data));
     }
 
-    assert(!cell);
     assert(dataStack.empty());
 
     return cellStack;
 }
 
+Data::PooledStack Binary::acquire(PointPool& pool, const uint64_t np) const
+{
+    Data::Pool& dataPool(pool.dataPool());
+    if (dataPool.available() >= np) return dataPool.acquire(np);
+    else return dataPool.acquireContiguous(np);
+}
+
+char* Binary::contiguous(Data::PooledStack& dataStack) const
+{
+    if (dataStack.empty()) return nullptr;
+
+    const uint64_t pointSize(m_metadata.schema().pointSize());
+    char* const begin(**dataStack.head());
+    const char* expected(begin);
+
+    for (const char* data : dataStack)
+    {
+        if (data != expected) return nullptr;
+        expected += pointSize;
+    }
+
+    return begin;
+}
+
 } // namespace entwine
 
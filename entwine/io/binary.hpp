@@ -11,6 +11,8 @@
 #pragma once
 
 #include <entwine/io/io.hpp>
+#include <entwine/io/packer.hpp>
+#include <entwine/io/write-queue.hpp>
 
 #include <entwine/types/binary-point-table.hpp>
 
@@ -52,28 +54,75 @@ public:
             PointPool& pointPool,
             const std::string& filename) const override;
 
+    virtual std::vector<char> fetch(
+            const arbiter::Endpoint& out,
+            const arbiter::Endpoint& tmp,
+            const std::string& filename) const override
+    {
+        return getBuffer(out, tmp, filename + extension());
+    }
+
+    virtual Cell::PooledStack decode(
+            PointPool& pointPool,
+            const std::string& filename,
+            const std::vector<char>& data) const override;
+
+    virtual std::unique_ptr<uint64_t> storedSize(
+            const arbiter::Endpoint& out,
+            const arbiter::Endpoint& tmp,
+            const std::string& filename) const override
+    {
+        return m_metadata.packer().size(out, tmp, filename + extension());
+    }
+
 protected:
+    virtual std::string extension() const { return ".bin"; }
+
     std::vector<char> getBuffer(
             const Cell::PooledStack& cells,
             uint64_t np) const;
 
+    // Copy np points in our native schema into cells of the pool's schema,
+    // which may hold any subset of the native dimensions.
     Cell::PooledStack getCells(
             PointPool& pool,
-            const std::vector<char>& buffer) const;
+            const char* buffer,
+            uint64_t np) const;
 
+    // Wrap data nodes, each already populated with a single point in the
+    // pool's schema, into cells.
+    Cell::PooledStack getCells(
+            PointPool& pool,
+            Data::PooledStack dataStack) const;
+
+    // Acquire data nodes for np points.  If the pool does not have enough
+    // free nodes to satisfy this request without allocating, then they are
+    // allocated as a single contiguous block, which callers may fill in one
+    // pass - see contiguous().
+    Data::PooledStack acquire(PointPool& pool, uint64_t np) const;
+
+    // If these data nodes form a contiguous block, returns the start of that
+    // block, else nullptr.
+    char* contiguous(Data::PooledStack& dataStack) const;
+
+    // Chunk storage goes through the write queue, which may defer uploads to
+    // its own threads, and then through the packer, which stores small chunks
+    // in pack files if packing is enabled.
     std::vector<char> getBuffer(
             const arbiter::Endpoint& out,
+            const arbiter::Endpoint& tmp,
             const std::string& filename) const
     {
-        return *ensureGet(out, filename);
+        return m_metadata.writeQueue().get(out, tmp, filename);
     }
 
     virtual void writeBuffer(
             const arbiter::Endpoint& out,
+            const arbiter::Endpoint& tmp,
             const std::string filename,
-            const std::vector<char>& buffer) const
+            std::vector<char> buffer) const
     {
-        ensurePut(out, filename, buffer);
+        m_metadata.writeQueue().put(out, tmp, filename, std::move(buffer));
     }
 };
 
@@ -0,0 +1,743 @@
+/******************************************************************************
+* Copyright (c) 2018, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/io/columnar.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <stdexcept>
+
+#ifdef ENTWINE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace entwine
+{
+
+namespace
+{
+
+using DimType = pdal::Dimension::Type;
+
+const std::string magic("ECOL");
+
+enum class Codec : uint8_t
+{
+    // Packed values, exactly as they appear in our native schema.
+    Raw = 0,
+
+    // The first value, followed by zig-zagged deltas between subsequent values
+    // bit-packed at the width of the largest delta.  This is only chosen for
+    // integral dimensions.  Decoding works on raw bits, so it is valid for
+    // any type.
+    Delta = 1,
+
+    // Pairs of run length and value.
+    Rle = 2,
+
+    // A single Zstandard frame of the raw column.
+    Zstd = 3,
+
+    // For floating point dimensions, Delta applied to the bits of each value
+    // mapped so that their ordering matches that of the values.  Chunks are
+    // sorted by GpsTime, so its successive values are close in this mapping.
+    OrderedDelta = 4
+};
+
+template<typename T>
+void put(std::vector<char>& out, T v)
+{
+    const char* src(reinterpret_cast<const char*>(&v));
+    out.insert(out.end(), src, src + sizeof(T));
+}
+
+template<typename T>
+T get(const char*& pos, const char* end)
+{
+    if (pos + sizeof(T) > end)
+    {
+        throw std::runtime_error("Truncated columnar data");
+    }
+
+    T v;
+    std::memcpy(&v, pos, sizeof(T));
+    pos += sizeof(T);
+    return v;
+}
+
+bool isSigned(DimType type)
+{
+    return pdal::Dimension::base(type) == pdal::Dimension::BaseType::Signed;
+}
+
+bool isFloating(DimType type)
+{
+    return pdal::Dimension::base(type) == pdal::Dimension::BaseType::Floating;
+}
+
+// Widen a single value to 64 bits.  Signed values are sign-extended so that
+// small negative deltas remain small, and everything else is treated as its
+// raw bits.
+int64_t load(const char* pos, std::size_t size, bool sign)
+{
+    uint64_t u(0);
+    std::memcpy(&u, pos, size);
+
+    const std::size_t shift(64 - size * 8);
+    if (sign && shift) return static_cast<int64_t>(u << shift) >> shift;
+    return static_cast<int64_t>(u);
+}
+
+// Map the raw bits of a floating point value of this size onto an unsigned
+// integer whose ordering matches that of the values, like detail::orderedBits.
+// The two zeros are kept distinct so that the mapping may be inverted.
+uint64_t toOrdered(uint64_t u, std::size_t size)
+{
+    const uint64_t sign(1ULL << (size * 8 - 1));
+    const uint64_t mask(sign | (sign - 1));
+    return ((u & sign) ? ~u : (u | sign)) & mask;
+}
+
+uint64_t fromOrdered(uint64_t o, std::size_t size)
+{
+    const uint64_t sign(1ULL << (size * 8 - 1));
+    const uint64_t mask(sign | (sign - 1));
+    return ((o & sign) ? (o & ~sign) : ~o) & mask;
+}
+
+// Ordered deltas are only considered if every value is a number of the same
+// sign, otherwise the column is left to the other codecs.
+bool orderable(const std::vector<char>& column, const DimInfo& dim)
+{
+    const std::size_t size(dim.size());
+    if (size != sizeof(float) && size != sizeof(double)) return false;
+
+    const char* pos(column.data());
+    const char* end(pos + column.size());
+    if (pos == end) return false;
+
+    auto value([size](const char* p)
+    {
+        if (size == sizeof(float))
+        {
+            float f;
+            std::memcpy(&f, p, size);
+            return static_cast<double>(f);
+        }
+
+        double d;
+        std::memcpy(&d, p, size);
+        return d;
+    });
+
+    const bool sign(std::signbit(value(pos)));
+    for ( ; pos < end; pos += size)
+    {
+        const double v(value(pos));
+        if (std::isnan(v) || std::signbit(v) != sign) return false;
+    }
+
+    return true;
+}
+
+uint64_t zigZag(int64_t v)
+{
+    return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+int64_t unZigZag(uint64_t v)
+{
+    return static_cast<int64_t>((v >> 1) ^ (~(v & 1) + 1));
+}
+
+class BitWriter
+{
+public:
+    BitWriter(std::vector<char>& out) : m_out(out) { }
+
+    void write(uint64_t v, std::size_t width)
+    {
+        while (width)
+        {
+            const std::size_t n(std::min<std::size_t>(8 - m_used, width));
+            m_current |= (v & ((1u << n) - 1)) << m_used;
+            v >>= n;
+            width -= n;
+            m_used += n;
+
+            if (m_used == 8) flush();
+        }
+    }
+
+    void flush()
+    {
+        if (m_used) m_out.push_back(m_current);
+        m_current = 0;
+        m_used = 0;
+    }
+
+private:
+    std::vector<char>& m_out;
+    uint8_t m_current = 0;
+    std::size_t m_used = 0;
+};
+
+class BitReader
+{
+public:
+    BitReader(const char* pos, const char* end) : m_pos(pos), m_end(end) { }
+
+    uint64_t read(std::size_t width)
+    {
+        uint64_t v(0);
+        std::size_t shift(0);
+
+        while (width)
+        {
+            if (m_pos >= m_end)
+            {
+                throw std::runtime_error("Truncated columnar data");
+            }
+
+            const uint8_t byte(*m_pos);
+            const std::size_t n(std::min<std::size_t>(8 - m_used, width));
+            v |= static_cast<uint64_t>((byte >> m_used) & ((1u << n) - 1))
+                << shift;
+
+            shift += n;
+            width -= n;
+            m_used += n;
+
+            if (m_used == 8)
+            {
+                ++m_pos;
+                m_used = 0;
+            }
+        }
+
+        return v;
+    }
+
+private:
+    const char* m_pos;
+    const char* m_end;
+    std::size_t m_used = 0;
+};
+
+std::vector<char> encodeDelta(
+        const std::vector<char>& column,
+        const DimInfo& dim)
+{
+    std::vector<char> out;
+
+    const std::size_t size(dim.size());
+    const bool sign(isSigned(dim.type()));
+    const uint64_t np(column.size() / size);
+    if (!np) return out;
+
+    std::vector<uint64_t> deltas;
+    deltas.reserve(np - 1);
+
+    int64_t prev(load(column.data(), size, sign));
+    uint64_t max(0);
+
+    for (uint64_t i(1); i < np; ++i)
+    {
+        const int64_t v(load(column.data() + i * size, size, sign));
+        deltas.push_back(
+                zigZag(
+                    static_cast<int64_t>(
+                        static_cast<uint64_t>(v) -
+                        static_cast<uint64_t>(prev))));
+        max = std::max(max, deltas.back());
+        prev = v;
+    }
+
+    uint8_t width(0);
+    while (width < 64 && (max >> width)) ++width;
+
+    put<int64_t>(out, load(column.data(), size, sign));
+    put<uint8_t>(out, width);
+
+    BitWriter writer(out);
+    for (const uint64_t d : deltas) writer.write(d, width);
+    writer.flush();
+
+    return out;
+}
+
+void decodeDelta(
+        const char* pos,
+        const char* end,
+        const DimInfo& dim,
+        uint64_t np,
+        char* dst)
+{
+    if (!np) return;
+
+    const std::size_t size(dim.size());
+    int64_t v(get<int64_t>(pos, end));
+    const uint8_t width(get<uint8_t>(pos, end));
+
+    std::memcpy(dst, &v, size);
+
+    BitReader reader(pos, end);
+    for (uint64_t i(1); i < np; ++i)
+    {
+        v = static_cast<int64_t>(
+                static_cast<uint64_t>(v) +
+                static_cast<uint64_t>(unZigZag(reader.read(width))));
+        std::memcpy(dst + i * size, &v, size);
+    }
+}
+
+std::vector<char> encodeOrderedDelta(
+        std::vector<char> column,
+        const DimInfo& dim)
+{
+    const std::size_t size(dim.size());
+    for (char* pos(column.data()); pos < column.data() + column.size(); )
+    {
+        uint64_t u(0);
+        std::memcpy(&u, pos, size);
+        u = toOrdered(u, size);
+        std::memcpy(pos, &u, size);
+        pos += size;
+    }
+
+    return encodeDelta(column, dim);
+}
+
+void decodeOrderedDelta(
+        const char* pos,
+        const char* end,
+        const DimInfo& dim,
+        uint64_t np,
+        char* dst)
+{
+    decodeDelta(pos, end, dim, np, dst);
+
+    const std::size_t size(dim.size());
+    for (uint64_t i(0); i < np; ++i)
+    {
+        uint64_t u(0);
+        std::memcpy(&u, dst + i * size, size);
+        u = fromOrdered(u, size);
+        std::memcpy(dst + i * size, &u, size);
+    }
+}
+
+std::vector<char> encodeRle(
+        const std::vector<char>& column,
+        const DimInfo& dim)
+{
+    std::vector<char> out;
+
+    const std::size_t size(dim.size());
+    const char* end(column.data() + column.size());
+    const char* pos(column.data());
+
+    while (pos < end)
+    {
+        const char* run(pos + size);
+        uint32_t n(1);
+
+        while (
+                run < end &&
+                n < std::numeric_limits<uint32_t>::max() &&
+                std::equal(run, run + size, pos))
+        {
+            run += size;
+            ++n;
+        }
+
+        put<uint32_t>(out, n);
+        out.insert(out.end(), pos, pos + size);
+        pos = run;
+    }
+
+    return out;
+}
+
+void decodeRle(
+        const char* pos,
+        const char* end,
+        const DimInfo& dim,
+        uint64_t np,
+        char* dst)
+{
+    const std::size_t size(dim.size());
+    const char* dstEnd(dst + np * size);
+
+    while (dst < dstEnd)
+    {
+        const uint32_t n(get<uint32_t>(pos, end));
+        if (pos + size > end || dst + n * size > dstEnd)
+        {
+            throw std::runtime_error("Invalid columnar run length");
+        }
+
+        for (uint32_t i(0); i < n; ++i)
+        {
+            dst = std::copy(pos, pos + size, dst);
+        }
+
+        pos += size;
+    }
+}
+
+#ifdef ENTWINE_ZSTD
+std::vector<char> encodeZstd(const std::vector<char>& column)
+{
+    std::vector<char> out(ZSTD_compressBound(column.size()));
+    const std::size_t size(
+            ZSTD_compress(
+                out.data(),
+                out.size(),
+                column.data(),
+                column.size(),
+                3));
+
+    if (ZSTD_isError(size))
+    {
+        throw std::runtime_error(
+                std::string("Zstandard compression failure: ") +
+                ZSTD_getErrorName(size));
+    }
+
+    out.resize(size);
+    return out;
+}
+#endif
+
+void decodeZstd(const char* pos, const char* end, std::size_t size, char* dst)
+{
+#ifdef ENTWINE_ZSTD
+    const std::size_t result(ZSTD_decompress(dst, size, pos, end - pos));
+    if (ZSTD_isError(result) || result != size)
+    {
+        throw std::runtime_error("Zstandard column decompression failure");
+    }
+#else
+    throw std::runtime_error("Entwine was built without Zstandard support");
+#endif
+}
+
+// Encode with each candidate codec for this dimension, keeping the smallest.
+std::pair<Codec, std::vector<char>> encode(
+        const std::vector<char>& column,
+        const DimInfo& dim)
+{
+    std::pair<Codec, std::vector<char>> best(Codec::Raw, column);
+
+    auto consider([&best](Codec codec, std::vector<char> data)
+    {
+        if (data.size() < best.second.size())
+        {
+            best = std::make_pair(codec, std::move(data));
+        }
+    });
+
+    if (isFloating(dim.type()))
+    {
+        if (orderable(column, dim))
+        {
+            consider(Codec::OrderedDelta, encodeOrderedDelta(column, dim));
+        }
+    }
+    else if (dim.size() > 1)
+    {
+        consider(Codec::Delta, encodeDelta(column, dim));
+    }
+    consider(Codec::Rle, encodeRle(column, dim));
+#ifdef ENTWINE_ZSTD
+    consider(Codec::Zstd, encodeZstd(column));
+#endif
+
+    return best;
+}
+
+void decode(
+        Codec codec,
+        const char* pos,
+        const char* end,
+        const DimInfo& dim,
+        uint64_t np,
+        char* dst)
+{
+    const std::size_t size(np * dim.size());
+
+    switch (codec)
+    {
+        case Codec::Raw:
+            if (static_cast<std::size_t>(end - pos) != size)
+            {
+                throw std::runtime_error("Invalid raw column size");
+            }
+            std::copy(pos, end, dst);
+            break;
+        case Codec::Delta:  decodeDelta(pos, end, dim, np, dst);   break;
+        case Codec::Rle:    decodeRle(pos, end, dim, np, dst);     break;
+        case Codec::Zstd:   decodeZstd(pos, end, size, dst);       break;
+        case Codec::OrderedDelta:
+            decodeOrderedDelta(pos, end, dim, np, dst);
+            break;
+        default: throw std::runtime_error("Invalid column codec");
+    }
+}
+
+struct Column
+{
+    Codec codec;
+    uint64_t offset;
+    uint64_t size;
+};
+
+// Check that this column can hold exactly np values without decoding it, so
+// that a corrupt point count is caught before we allocate for it.
+void validate(
+        const Column& c,
+        const char* pos,
+        const DimInfo& dim,
+        const uint64_t np)
+{
+    const char* end(pos + c.size);
+    const std::size_t size(dim.size());
+
+    auto fail([&dim]()
+    {
+        throw std::runtime_error(
+                "Invalid columnar point count for " + dim.name());
+    });
+
+    switch (c.codec)
+    {
+        case Codec::Raw:
+            if (c.size % size || c.size / size != np) fail();
+            break;
+        case Codec::Delta:
+        case Codec::OrderedDelta:
+        {
+            if (!np) break;
+
+            get<int64_t>(pos, end);
+            const uint8_t width(get<uint8_t>(pos, end));
+            if (width > 64) fail();
+
+            // The remaining np - 1 deltas are packed at this width.
+            const uint64_t bits(static_cast<uint64_t>(end - pos) * 8);
+            if (width && np - 1 > bits / width) fail();
+            break;
+        }
+        case Codec::Rle:
+        {
+            uint64_t total(0);
+            while (pos < end)
+            {
+                total += get<uint32_t>(pos, end);
+                if (total > np || static_cast<std::size_t>(end - pos) < size)
+                {
+                    fail();
+                }
+                pos += size;
+            }
+            if (total != np) fail();
+            break;
+        }
+        case Codec::Zstd:
+        {
+#ifdef ENTWINE_ZSTD
+            const auto n(ZSTD_getFrameContentSize(pos, c.size));
+            if (
+                    n == ZSTD_CONTENTSIZE_UNKNOWN ||
+                    n == ZSTD_CONTENTSIZE_ERROR ||
+                    n % size ||
+                    n / size != np)
+            {
+                fail();
+            }
+#endif
+            break;
+        }
+        default: throw std::runtime_error("Invalid column codec");
+    }
+}
+
+} // unnamed namespace
+
+void Columnar::write(
+        const arbiter::Endpoint& out,
+        const arbiter::Endpoint& tmp,
+        PointPool& pointPool,
+        const std::string& filename,
+        Cell::PooledStack&& cells,
+        const uint64_t np) const
+{
+    const Schema& schema(m_metadata.schema());
+    const std::size_t pointSize(schema.pointSize());
+
+    const std::vector<char> rows(getBuffer(cells, np));
+    pointPool.release(std::move(cells));
+
+    std::vector<std::pair<Codec, std::vector<char>>> encoded;
+    std::vector<char> column;
+
+    for (const DimInfo& dim : schema.dims())
+    {
+        const std::size_t size(dim.size());
+        const std::size_t offset(
+                schema.pdalLayout().dimDetail(dim.id())->offset());
+
+        column.resize(np * size);
+        for (uint64_t i(0); i < np; ++i)
+        {
+            const char* src(rows.data() + i * pointSize + offset);
+            std::copy(src, src + size, column.data() + i * size);
+        }
+
+        encoded.push_back(encode(column, dim));
+    }
+
+    // Magic, point count, and column count, followed by the directory.
+    uint64_t dataOffset(magic.size() + sizeof(uint64_t) + sizeof(uint32_t));
+    for (const DimInfo& dim : schema.dims())
+    {
+        dataOffset += 1 + dim.name().size() + 1 + 2 * sizeof(uint64_t);
+    }
+
+    std::vector<char> data(magic.begin(), magic.end());
+    put<uint64_t>(data, np);
+    put<uint32_t>(data, schema.dims().size());
+
+    for (std::size_t i(0); i < encoded.size(); ++i)
+    {
+        const std::string name(schema.dims()[i].name());
+        if (name.size() > std::numeric_limits<uint8_t>::max())
+        {
+            throw std::runtime_error("Dimension name too long: " + name);
+        }
+
+        put<uint8_t>(data, name.size());
+        data.insert(data.end(), name.begin(), name.end());
+        put<uint8_t>(data, static_cast<uint8_t>(encoded[i].first));
+        put<uint64_t>(data, dataOffset);
+        put<uint64_t>(data, encoded[i].second.size());
+
+        dataOffset += encoded[i].second.size();
+    }
+
+    for (const auto& e : encoded)
+    {
+        data.insert(data.end(), e.second.begin(), e.second.end());
+    }
+
+    assert(data.size() == dataOffset);
+
+    writeBuffer(out, tmp, filename + ".col", std::move(data));
+}
+
+Cell::PooledStack Columnar::decode(
+        PointPool& pool,
+        const std::string& filename,
+        const std::vector<char>& data) const
+{
+    const char* pos(data.data());
+    const char* end(data.data() + data.size());
+
+    if (
+            data.size() < magic.size() ||
+            !std::equal(magic.begin(), magic.end(), pos))
+    {
+        throw std::runtime_error("Invalid columnar data: " + filename);
+    }
+
+    pos += magic.size();
+
+    const uint64_t np(get<uint64_t>(pos, end));
+    const uint32_t numColumns(get<uint32_t>(pos, end));
+
+    std::map<std::string, Column> columns;
+    for (uint32_t i(0); i < numColumns; ++i)
+    {
+        const uint8_t length(get<uint8_t>(pos, end));
+        if (pos + length > end)
+        {
+            throw std::runtime_error("Invalid columnar directory");
+        }
+
+        const std::string name(pos, length);
+        pos += length;
+
+        Column& column(columns[name]);
+        column.codec = static_cast<Codec>(get<uint8_t>(pos, end));
+        column.offset = get<uint64_t>(pos, end);
+        column.size = get<uint64_t>(pos, end);
+
+        if (
+                column.offset > data.size() ||
+                column.size > data.size() - column.offset)
+        {
+            throw std::runtime_error("Invalid columnar directory");
+        }
+    }
+
+    const Schema& schema(pool.schema());
+    for (const DimInfo& dim : schema.dims())
+    {
+        const auto it(columns.find(dim.name()));
+        if (it != columns.end())
+        {
+            validate(it->second, data.data() + it->second.offset, dim, np);
+        }
+    }
+
+    Data::PooledStack dataStack(acquire(pool, np));
+
+    std::vector<char*> points;
+    points.reserve(np);
+    for (char* p : dataStack) points.push_back(p);
+
+    std::vector<char> column;
+
+    for (const DimInfo& dim : schema.dims())
+    {
+        const std::size_t size(dim.size());
+        const std::size_t offset(
+                schema.pdalLayout().dimDetail(dim.id())->offset());
+
+        const auto it(columns.find(dim.name()));
+        if (it == columns.end())
+        {
+            for (char* p : points) std::fill(p + offset, p + offset + size, 0);
+            continue;
+        }
+
+        const Column& c(it->second);
+        const char* begin(data.data() + c.offset);
+
+        column.resize(np * size);
+        decode(c.codec, begin, begin + c.size, dim, np, column.data());
+
+        for (uint64_t i(0); i < np; ++i)
+        {
+            const char* src(column.data() + i * size);
+            std::copy(src, src + size, points[i] + offset);
+        }
+    }
+
+    return getCells(pool, std::move(dataStack));
+}
+
+} // namespace entwine
+
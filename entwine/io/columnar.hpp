@@ -0,0 +1,49 @@
+/******************************************************************************
+* Copyright (c) 2018, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <entwine/io/binary.hpp>
+
+namespace entwine
+{
+
+// Each chunk stores every dimension of the sorted binary point data as its
+// own column, each encoded with whichever of its candidate codecs produces
+// the smallest output.  A directory at the start of the file locates each
+// column by name, so a column may be decoded without touching the others.
+class Columnar : public Binary
+{
+public:
+    Columnar(const Metadata& m) : Binary(m) { }
+
+    virtual std::string type() const override { return "columnar"; }
+
+    virtual void write(
+            const arbiter::Endpoint& out,
+            const arbiter::Endpoint& tmp,
+            PointPool& pointPool,
+            const std::string& filename,
+            Cell::PooledStack&& cells,
+            uint64_t np) const override;
+
+    virtual Cell::PooledStack decode(
+            PointPool& pointPool,
+            const std::string& filename,
+            const std::vector<char>& data) const override;
+
+    virtual bool compressed() const override { return true; }
+
+protected:
+    virtual std::string extension() const override { return ".col"; }
+};
+
+} // namespace entwine
+
@@ -101,6 +101,43 @@ std::unique_ptr<std::vector<char>> ensureGet(
     return data;
 }
 
+std::vector<char> ensureGetRange(
+        const arbiter::Endpoint& endpoint,
+        const std::string& path,
+        const uint64_t offset,
+        const uint64_t size)
+{
+    arbiter::http::Headers headers;
+    headers["Range"] =
+        "bytes=" + std::to_string(offset) + "-" +
+        std::to_string(offset + size - 1);
+
+    std::unique_ptr<std::vector<char>> data;
+
+    bool done(false);
+    std::size_t tried(0);
+
+    while (!done)
+    {
+        data = endpoint.tryGetBinary(path, headers);
+
+        if (data && data->size() == size)
+        {
+            done = true;
+        }
+        else
+        {
+            if (++tried < retries)
+            {
+                sleep(tried, "GET", endpoint.prefixedRoot() + path);
+            }
+            else suicide("GET");
+        }
+    }
+
+    return *data;
+}
+
 std::string ensureGetString(
         const arbiter::Endpoint& endpoint,
         const std::string& path)
@@ -10,6 +10,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <vector>
@@ -36,6 +37,14 @@ std::unique_ptr<std::vector<char>> ensureGet(
         const arbiter::Endpoint& endpoint,
         const std::string& path);
 
+// Fetch size bytes from offset within this path with an HTTP range request,
+// retrying like ensureGet.  A response of any other size is a failure.
+std::vector<char> ensureGetRange(
+        const arbiter::Endpoint& endpoint,
+        const std::string& path,
+        uint64_t offset,
+        uint64_t size);
+
 std::string ensureGetString(
         const arbiter::Endpoint& endpoint,
         const std::string& path);
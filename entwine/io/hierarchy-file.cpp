@@ -0,0 +1,229 @@
+/******************************************************************************
+* Copyright (c) 2018, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/io/hierarchy-file.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include <entwine/io/mapped-file.hpp>
+#include <entwine/util/json.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+    // Binary layout: a header of the magic bytes, a version, and the record
+    // count, followed by records of D, X, Y, Z, and point count sorted by key.
+    // All values are little-endian.
+    const std::string magic("EHIB");
+    const uint32_t version(1);
+    const std::size_t headerSize(16);
+    const std::size_t recordSize(5 * sizeof(uint64_t));
+
+    uint64_t at(const char* record, std::size_t field)
+    {
+        uint64_t v;
+        std::memcpy(&v, record + field * sizeof(uint64_t), sizeof(uint64_t));
+        return v;
+    }
+
+    template<typename T>
+    void put(std::vector<char>& data, T v)
+    {
+        const char* pos(reinterpret_cast<const char*>(&v));
+        data.insert(data.end(), pos, pos + sizeof(T));
+    }
+
+    bool isBinary(const std::string& type)
+    {
+        HierarchyFile::check(type);
+        return type == "binary";
+    }
+} // unnamed namespace
+
+void HierarchyFile::check(const std::string& type)
+{
+    if (type != "json" && type != "binary")
+    {
+        throw std::runtime_error("Invalid hierarchy type: " + type);
+    }
+}
+
+std::string HierarchyFile::extension(const std::string& type)
+{
+    return isBinary(type) ? ".bin" : ".json";
+}
+
+std::vector<char> HierarchyFile::serialize(
+        const std::string& type,
+        std::vector<Record>& records)
+{
+    std::sort(
+            records.begin(),
+            records.end(),
+            [](const Record& a, const Record& b)
+            {
+                return
+                    a.d < b.d || (a.d == b.d &&
+                    (a.x < b.x || (a.x == b.x &&
+                    (a.y < b.y || (a.y == b.y && a.z < b.z)))));
+            });
+
+    std::vector<char> data;
+
+    if (!isBinary(type))
+    {
+        data.reserve(2 + records.size() * 24);
+        data.push_back('{');
+
+        for (std::size_t i(0); i < records.size(); ++i)
+        {
+            const Record& r(records[i]);
+            if (i) data.push_back(',');
+
+            const std::string s(
+                    "\"" + std::to_string(r.d) + "-" + std::to_string(r.x) +
+                    "-" + std::to_string(r.y) + "-" + std::to_string(r.z) +
+                    "\":" + std::to_string(r.n));
+            data.insert(data.end(), s.begin(), s.end());
+        }
+
+        data.push_back('}');
+        return data;
+    }
+
+    data.reserve(headerSize + records.size() * recordSize);
+
+    data.insert(data.end(), magic.begin(), magic.end());
+    put<uint32_t>(data, version);
+    put<uint64_t>(data, records.size());
+
+    for (const Record& r : records)
+    {
+        put<uint64_t>(data, r.d);
+        put<uint64_t>(data, r.x);
+        put<uint64_t>(data, r.y);
+        put<uint64_t>(data, r.z);
+        put<uint64_t>(data, r.n);
+    }
+
+    return data;
+}
+
+std::unique_ptr<HierarchyFile> HierarchyFile::load(
+        const std::string& type,
+        const arbiter::Endpoint& ep,
+        const std::string& basename)
+{
+    const std::string filename(basename + extension(type));
+    std::unique_ptr<HierarchyFile> result;
+
+    if (!isBinary(type))
+    {
+        const Json::Value json(parse(ep.get(filename)));
+
+        std::vector<Record> records;
+        for (const auto s : json.getMemberNames())
+        {
+            records.emplace_back(Dxyz(s), json[s].asUInt64());
+        }
+
+        result.reset(new HierarchyFile(serialize("binary", records)));
+    }
+    else if (ep.isLocal())
+    {
+        if (auto file = MappedFile::create(ep.prefixedRoot() + filename))
+        {
+            result.reset(new HierarchyFile(std::move(file)));
+        }
+    }
+
+    if (!result) result.reset(new HierarchyFile(ep.getBinary(filename)));
+    return result;
+}
+
+HierarchyFile::HierarchyFile(std::vector<char> buffer)
+    : m_buffer(std::move(buffer))
+{
+    init(m_buffer.data(), m_buffer.size());
+}
+
+HierarchyFile::HierarchyFile(std::unique_ptr<MappedFile> file)
+    : m_file(std::move(file))
+    , m_mappedSize(m_file->size())
+{
+    init(m_file->data(), m_file->size());
+}
+
+HierarchyFile::~HierarchyFile() { }
+
+void HierarchyFile::init(const char* data, const std::size_t size)
+{
+    if (
+            size < headerSize ||
+            std::string(data, magic.size()) != magic)
+    {
+        throw std::runtime_error("Invalid binary hierarchy file");
+    }
+
+    uint32_t v;
+    std::memcpy(&v, data + magic.size(), sizeof(uint32_t));
+    if (v != version)
+    {
+        throw std::runtime_error(
+                "Unsupported binary hierarchy version: " + std::to_string(v));
+    }
+
+    uint64_t n;
+    std::memcpy(&n, data + magic.size() + sizeof(uint32_t), sizeof(uint64_t));
+    if (size != headerSize + n * recordSize)
+    {
+        throw std::runtime_error("Invalid binary hierarchy size");
+    }
+
+    m_records = data + headerSize;
+    m_size = n;
+}
+
+Dxyz HierarchyFile::key(const std::size_t i) const
+{
+    const char* r(m_records + i * recordSize);
+    return Dxyz(at(r, 0), at(r, 1), at(r, 2), at(r, 3));
+}
+
+uint64_t HierarchyFile::count(const std::size_t i) const
+{
+    return at(m_records + i * recordSize, 4);
+}
+
+uint64_t HierarchyFile::count(const Dxyz& k) const
+{
+    std::size_t lo(0);
+    std::size_t hi(m_size);
+
+    while (lo < hi)
+    {
+        const std::size_t mid(lo + (hi - lo) / 2);
+        const char* r(m_records + mid * recordSize);
+
+        const Dxyz curr(at(r, 0), at(r, 1), at(r, 2), at(r, 3));
+        if (curr == k) return at(r, 4);
+        else if (curr < k) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return 0;
+}
+
+} // namespace entwine
+
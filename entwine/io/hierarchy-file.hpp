@@ -0,0 +1,85 @@
+/******************************************************************************
+* Copyright (c) 2018, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/types/key.hpp>
+
+namespace entwine
+{
+
+class MappedFile;
+
+// A single hierarchy file, holding the point counts for some subtree of the
+// octree.  The "json" type maps stringified keys to their counts, and must be
+// parsed when loaded.  The "binary" type is a sorted array of fixed-width
+// records which is searched in place, and is memory-mapped if local.
+class HierarchyFile
+{
+public:
+    struct Record
+    {
+        Record(const Dxyz& k, uint64_t n)
+            : d(k.d), x(k.p.x), y(k.p.y), z(k.p.z), n(n)
+        { }
+
+        uint64_t d, x, y, z, n;
+    };
+
+    // Throws if this is not a known hierarchy type.
+    static void check(const std::string& type);
+    static std::string extension(const std::string& type);
+
+    // Records are sorted by key, and then written directly without any
+    // intermediate representation.
+    static std::vector<char> serialize(
+            const std::string& type,
+            std::vector<Record>& records);
+
+    static std::unique_ptr<HierarchyFile> load(
+            const std::string& type,
+            const arbiter::Endpoint& ep,
+            const std::string& basename);
+
+    ~HierarchyFile();
+
+    std::size_t size() const { return m_size; }
+
+    Dxyz key(std::size_t i) const;
+    uint64_t count(std::size_t i) const;
+
+    // Returns zero if this key is not present.
+    uint64_t count(const Dxyz& key) const;
+
+    // Total size of this file in memory.
+    std::size_t bytes() const { return m_buffer.size() + m_mappedSize; }
+
+private:
+    HierarchyFile(std::vector<char> buffer);
+    HierarchyFile(std::unique_ptr<MappedFile> file);
+
+    void init(const char* data, std::size_t size);
+
+    std::vector<char> m_buffer;
+    std::unique_ptr<MappedFile> m_file;
+    std::size_t m_mappedSize = 0;
+
+    const char* m_records = nullptr;
+    std::size_t m_size = 0;
+};
+
+} // namespace entwine
+
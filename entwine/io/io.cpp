@@ -13,6 +13,7 @@
 #include <stdexcept>
 
 #include <entwine/io/binary.hpp>
+#include <entwine/io/columnar.hpp>
 #include <entwine/io/laszip.hpp>
 #include <entwine/io/zstandard.hpp>
 
@@ -26,6 +27,7 @@ std::unique_ptr<DataIo> DataIo::create(const Metadata& m, std::string type)
     if (type == "laszip") return makeUnique<Laz>(m);
     if (type == "binary") return makeUnique<Binary>(m);
     if (type == "zstandard") return makeUnique<Zstandard>(m);
+    if (type == "columnar") return makeUnique<Columnar>(m);
     throw std::runtime_error("Invalid data IO type: " + type);
 }
 
@@ -45,8 +45,41 @@ public:
             const arbiter::Endpoint& out,
             const arbiter::Endpoint& tmp,
             PointPool& pointPool,
+            const std::string& filename) const
+    {
+        return decode(pointPool, filename, fetch(out, tmp, filename));
+    }
+
+    // Reading is split into fetching the stored bytes of a chunk and then
+    // decoding them, so readers may cache the stored bytes separately.
+    //
+    // Points are decoded into the schema of the point pool, which may hold
+    // any subset of the native dimensions, so that readers needing only some
+    // dimensions may skip the rest where the format allows.
+    virtual std::vector<char> fetch(
+            const arbiter::Endpoint& out,
+            const arbiter::Endpoint& tmp,
             const std::string& filename) const = 0;
 
+    virtual Cell::PooledStack decode(
+            PointPool& pointPool,
+            const std::string& filename,
+            const std::vector<char>& data) const = 0;
+
+    // The number of bytes which fetch would return for this chunk, found
+    // without fetching it.  Returns null if this is not known.
+    virtual std::unique_ptr<uint64_t> storedSize(
+            const arbiter::Endpoint& out,
+            const arbiter::Endpoint& tmp,
+            const std::string& filename) const
+    {
+        return std::unique_ptr<uint64_t>();
+    }
+
+    // True if stored chunks are compressed, or otherwise encoded, so that
+    // they are smaller than their decoded cells.
+    virtual bool compressed() const { return false; }
+
 protected:
     const Metadata& m_metadata;
 };
@@ -10,13 +10,393 @@
 
 #include <entwine/io/laszip.hpp>
 
-#include <pdal/io/LasWriter.hpp>
+#include <algorithm>
+#include <cassert>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <istream>
+#include <ostream>
+#include <streambuf>
+#include <vector>
 
-#include <entwine/util/executor.hpp>
+#include <pdal/PointRef.hpp>
+#include <pdal/compression/LazPerfVlrCompression.hpp>
+
+#include <entwine/types/binary-point-table.hpp>
 
 namespace entwine
 {
 
+namespace
+{
+
+using DimId = pdal::Dimension::Id;
+using DimType = pdal::Dimension::Type;
+
+// We write LAS 1.4, since the SRS is stored as WKT, which earlier versions
+// do not support.  Point formats 0-3 remain valid in 1.4, and the legacy
+// point counts are populated for older readers.  See:
+// https://www.asprs.org/wp-content/uploads/2010/12/LAS_1_4_r13.pdf
+const uint16_t headerSize(375);
+const uint16_t legacyHeaderSize(227);
+const uint16_t vlrHeaderSize(54);
+const uint16_t extraBytesSize(192);
+const uint32_t chunkSize(50000);
+
+// Global encoding bit signifying that the SRS is stored as WKT.
+const uint16_t wktMask(1 << 4);
+
+const std::array<DimId, 3> xyzIds { { DimId::X, DimId::Y, DimId::Z } };
+
+template<typename T>
+void put(std::ostream& os, T v)
+{
+    os.write(reinterpret_cast<const char*>(&v), sizeof(T));
+}
+
+void put(std::ostream& os, std::string s, std::size_t size)
+{
+    s.resize(size, '\0');
+    os.write(s.data(), size);
+}
+
+void putVlrHeader(
+        std::ostream& os,
+        const std::string& userId,
+        uint16_t recordId,
+        uint16_t length,
+        const std::string& description)
+{
+    put<uint16_t>(os, 0);
+    put(os, userId, 16);
+    put<uint16_t>(os, recordId);
+    put<uint16_t>(os, length);
+    put(os, description, 32);
+}
+
+uint8_t extraBytesType(DimType type)
+{
+    switch (type)
+    {
+        case DimType::Unsigned8:    return 1;
+        case DimType::Signed8:      return 2;
+        case DimType::Unsigned16:   return 3;
+        case DimType::Signed16:     return 4;
+        case DimType::Unsigned32:   return 5;
+        case DimType::Signed32:     return 6;
+        case DimType::Unsigned64:   return 7;
+        case DimType::Signed64:     return 8;
+        case DimType::Float:        return 9;
+        case DimType::Double:       return 10;
+        default: throw std::runtime_error("Invalid extra-bytes type");
+    }
+}
+
+std::pair<uint16_t, uint16_t> creationDate()
+{
+    const std::time_t t(
+            std::chrono::system_clock::to_time_t(
+                std::chrono::system_clock::now()));
+
+    std::tm tm;
+#ifdef _WIN32
+    gmtime_s(&tm, &t);
+#else
+    gmtime_r(&t, &tm);
+#endif
+
+    return std::make_pair(tm.tm_yday + 1, tm.tm_year + 1900);
+}
+
+// Writes a single point, given in our native schema, as a LAS point record of
+// format 0-3 followed by its extra bytes.
+class LasFormat
+{
+public:
+    LasFormat(const Schema& schema)
+        : m_schema(schema)
+        , m_time(schema.hasTime())
+        , m_color(schema.hasColor())
+    {
+        for (const DimInfo& dim : schema.dims())
+        {
+            if (DimInfo::isXyz(dim) || isLasDim(dim.id())) continue;
+
+            const auto* detail(schema.pdalLayout().dimDetail(dim.id()));
+            m_extra.emplace_back(dim, detail->offset());
+            m_extraSize += dim.size();
+        }
+    }
+
+    uint8_t id() const { return (m_time ? 1 : 0) | (m_color ? 2 : 0); }
+
+    uint16_t pointSize() const
+    {
+        return 20 + (m_time ? 8 : 0) + (m_color ? 6 : 0) + m_extraSize;
+    }
+
+    uint16_t extraSize() const { return m_extraSize; }
+
+    const std::vector<std::pair<DimInfo, std::size_t>>& extra() const
+    {
+        return m_extra;
+    }
+
+    // Returns the return number of this point.
+    uint8_t write(
+            const pdal::PointRef& pr,
+            const char* data,
+            const std::array<int32_t, 3>& xyz,
+            char* dst) const
+    {
+        auto field([this, &pr](DimId id)
+        {
+            return m_schema.contains(id) ? pr.getFieldAs<double>(id) : 0.0;
+        });
+
+        for (const int32_t v : xyz) insert(v, dst);
+
+        insert<uint16_t>(field(DimId::Intensity), dst);
+
+        const uint8_t ret(field(DimId::ReturnNumber));
+        const uint8_t flags(
+                (ret & 0x07) |
+                ((uint8_t(field(DimId::NumberOfReturns)) & 0x07) << 3) |
+                ((uint8_t(field(DimId::ScanDirectionFlag)) & 0x01) << 6) |
+                ((uint8_t(field(DimId::EdgeOfFlightLine)) & 0x01) << 7));
+        insert(flags, dst);
+
+        insert<uint8_t>(field(DimId::Classification), dst);
+        insert<int8_t>(std::lround(field(DimId::ScanAngleRank)), dst);
+        insert<uint8_t>(field(DimId::UserData), dst);
+        insert<uint16_t>(field(DimId::PointSourceId), dst);
+
+        if (m_time) insert<double>(field(DimId::GpsTime), dst);
+
+        if (m_color)
+        {
+            insert<uint16_t>(field(DimId::Red), dst);
+            insert<uint16_t>(field(DimId::Green), dst);
+            insert<uint16_t>(field(DimId::Blue), dst);
+        }
+
+        for (const auto& p : m_extra)
+        {
+            const char* src(data + p.second);
+            dst = std::copy(src, src + p.first.size(), dst);
+        }
+
+        return ret;
+    }
+
+private:
+    bool isLasDim(DimId id) const
+    {
+        switch (id)
+        {
+            case DimId::Intensity:
+            case DimId::ReturnNumber:
+            case DimId::NumberOfReturns:
+            case DimId::ScanDirectionFlag:
+            case DimId::EdgeOfFlightLine:
+            case DimId::Classification:
+            case DimId::ScanAngleRank:
+            case DimId::UserData:
+            case DimId::PointSourceId:
+                return true;
+            case DimId::GpsTime:
+                return m_time;
+            case DimId::Red:
+            case DimId::Green:
+            case DimId::Blue:
+                return m_color;
+            default:
+                return false;
+        }
+    }
+
+    template<typename T>
+    static void insert(T v, char*& dst)
+    {
+        std::memcpy(dst, &v, sizeof(T));
+        dst += sizeof(T);
+    }
+
+    const Schema& m_schema;
+    const bool m_time;
+    const bool m_color;
+
+    std::vector<std::pair<DimInfo, std::size_t>> m_extra;
+    uint16_t m_extraSize = 0;
+};
+
+template<typename T>
+T get(const char* pos)
+{
+    T v;
+    std::memcpy(&v, pos, sizeof(T));
+    return v;
+}
+
+DimType extraBytesDimType(uint8_t type)
+{
+    switch (type)
+    {
+        case 1:     return DimType::Unsigned8;
+        case 2:     return DimType::Signed8;
+        case 3:     return DimType::Unsigned16;
+        case 4:     return DimType::Signed16;
+        case 5:     return DimType::Unsigned32;
+        case 6:     return DimType::Signed32;
+        case 7:     return DimType::Unsigned64;
+        case 8:     return DimType::Signed64;
+        case 9:     return DimType::Float;
+        case 10:    return DimType::Double;
+        default: throw std::runtime_error("Unsupported extra-bytes type");
+    }
+}
+
+double getAs(DimType type, const char* pos)
+{
+    switch (type)
+    {
+        case DimType::Unsigned8:    return get<uint8_t>(pos);
+        case DimType::Signed8:      return get<int8_t>(pos);
+        case DimType::Unsigned16:   return get<uint16_t>(pos);
+        case DimType::Signed16:     return get<int16_t>(pos);
+        case DimType::Unsigned32:   return get<uint32_t>(pos);
+        case DimType::Signed32:     return get<int32_t>(pos);
+        case DimType::Unsigned64:   return get<uint64_t>(pos);
+        case DimType::Signed64:     return get<int64_t>(pos);
+        case DimType::Float:        return get<float>(pos);
+        case DimType::Double:       return get<double>(pos);
+        default: throw std::runtime_error("Invalid extra-bytes type");
+    }
+}
+
+// A read-only, seekable stream buffer over memory we don't own, so the
+// decompressor can read directly from a downloaded buffer.
+class MemoryBuffer : public std::streambuf
+{
+public:
+    MemoryBuffer(const std::vector<char>& data)
+    {
+        char* begin(const_cast<char*>(data.data()));
+        setg(begin, begin, begin + data.size());
+    }
+
+protected:
+    virtual pos_type seekoff(
+            off_type off,
+            std::ios_base::seekdir dir,
+            std::ios_base::openmode which) override
+    {
+        char* pos(gptr());
+        if (dir == std::ios_base::beg) pos = eback() + off;
+        else if (dir == std::ios_base::cur) pos = gptr() + off;
+        else pos = egptr() + off;
+
+        if (pos < eback() || pos > egptr()) return pos_type(off_type(-1));
+
+        setg(eback(), pos, egptr());
+        return pos_type(pos - eback());
+    }
+
+    virtual pos_type seekpos(
+            pos_type pos,
+            std::ios_base::openmode which) override
+    {
+        return seekoff(off_type(pos), std::ios_base::beg, which);
+    }
+};
+
+// A writable, seekable stream buffer over a vector, so the compressor's output
+// may be handed off for upload without being copied.  Writes after a seek
+// backward overwrite the existing contents, and writes at the end append.
+class VectorBuffer : public std::streambuf
+{
+public:
+    VectorBuffer(std::vector<char>& data) : m_data(data) { }
+
+protected:
+    virtual int_type overflow(int_type c) override
+    {
+        if (traits_type::eq_int_type(c, traits_type::eof()))
+        {
+            return traits_type::not_eof(c);
+        }
+
+        const char ch(traits_type::to_char_type(c));
+        xsputn(&ch, 1);
+        return c;
+    }
+
+    virtual std::streamsize xsputn(const char* s, std::streamsize n) override
+    {
+        const std::size_t size(n);
+        const std::size_t overlap(std::min(size, m_data.size() - m_pos));
+
+        std::copy(s, s + overlap, m_data.begin() + m_pos);
+        m_data.insert(m_data.end(), s + overlap, s + size);
+        m_pos += size;
+        return n;
+    }
+
+    virtual pos_type seekoff(
+            off_type off,
+            std::ios_base::seekdir dir,
+            std::ios_base::openmode which) override
+    {
+        off_type pos(off);
+        if (dir == std::ios_base::cur) pos += m_pos;
+        else if (dir == std::ios_base::end) pos += m_data.size();
+
+        return seekpos(pos_type(pos), which);
+    }
+
+    virtual pos_type seekpos(
+            pos_type pos,
+            std::ios_base::openmode which) override
+    {
+        const off_type off(pos);
+        if (
+                !(which & std::ios_base::out) ||
+                off < 0 ||
+                off > static_cast<off_type>(m_data.size()))
+        {
+            return pos_type(off_type(-1));
+        }
+
+        m_pos = off;
+        return pos;
+    }
+
+private:
+    std::vector<char>& m_data;
+    std::size_t m_pos = 0;
+};
+
+// An extra-bytes dimension of a LAS point record which maps to a dimension of
+// our native schema.
+struct ExtraDim
+{
+    ExtraDim(const DimInfo& dim, std::size_t nativeOffset, DimType type)
+        : dim(dim)
+        , nativeOffset(nativeOffset)
+        , type(type)
+    { }
+
+    DimInfo dim;
+    std::size_t nativeOffset;
+    DimType type;
+    std::size_t lasOffset = 0;
+};
+
+} // unnamed namespace
+
 void Laz::write(
         const arbiter::Endpoint& out,
         const arbiter::Endpoint& tmp,
@@ -30,107 +410,414 @@ void Laz::write(
         throw std::runtime_error("Laszip storage requires scaling.");
     }
 
-    const bool local(out.isLocal());
-    const std::string localDir(
-            local ? out.prefixedRoot() : tmp.prefixedRoot());
-    const std::string localFile(
-            (local ? filename : arbiter::crypto::encodeAsHex(filename)) +
-            ".laz");
-
     const Schema& schema(m_metadata.schema());
     const Delta& delta(*m_metadata.delta());
-    Bounds bounds(Bounds::expander());
-    for (const Cell& c : cells) bounds.grow(c.point());
+    const Scale& scale(delta.scale());
+    const uint64_t nativePointSize(schema.pointSize());
 
-    CellTable table(
-            pointPool,
-            std::move(cells),
-            makeUnique<Schema>(Schema::normalize(schema)));
+    Bounds scaled(Bounds::expander());
+    for (const Cell& c : cells) scaled.grow(c.point());
 
-    assert(table.size() == np);
-
-    StreamReader reader(table);
+    // Our buffer is sorted by GpsTime, and holds points in our native schema.
+    const std::vector<char> buffer(getBuffer(cells, np));
+    pointPool.release(std::move(cells));
 
     const auto offset = Point::unscale(
-            bounds.mid(),
-            delta.scale(),
+            scaled.mid(),
+            scale,
             delta.offset())
         .apply([](double d) { return std::floor(d); });
 
-    // See https://www.pdal.io/stages/writers.las.html
-    const uint64_t timeMask(schema.hasTime() ? 1 : 0);
-    const uint64_t colorMask(schema.hasColor() ? 2 : 0);
+    const LasFormat format(schema);
 
-    pdal::Options options;
-    options.add("filename", localDir + localFile);
-    options.add("minor_version", 2);
-    options.add("extra_dims", "all");
-    options.add("software_id", "Entwine " + currentVersion().toString());
-    options.add("compression", "laszip");
-    options.add("dataformat_id", timeMask | colorMask);
+    laszip::factory::record_schema lazSchema;
+    lazSchema.push(laszip::factory::record_item::point());
+    if (schema.hasTime())
+    {
+        lazSchema.push(laszip::factory::record_item::gpstime());
+    }
+    if (schema.hasColor())
+    {
+        lazSchema.push(laszip::factory::record_item::rgb());
+    }
+    if (format.extraSize())
+    {
+        lazSchema.push(laszip::factory::record_item::eb(format.extraSize()));
+    }
+
+    std::vector<char> data;
+    VectorBuffer vectorBuffer(data);
+    std::ostream stream(&vectorBuffer);
+    pdal::LazPerfVlrCompressor compressor(stream, lazSchema, chunkSize);
+
+    const auto laszipVlr(compressor.vlrData());
+    const std::string& srs(m_metadata.srs());
+    const auto& extra(format.extra());
 
-    options.add("scale_x", delta.scale().x);
-    options.add("scale_y", delta.scale().y);
-    options.add("scale_z", delta.scale().z);
+    uint32_t numVlrs(1);
+    uint32_t pointOffset(headerSize + vlrHeaderSize + laszipVlr.size());
 
-    options.add("offset_x", offset.x);
-    options.add("offset_y", offset.y);
-    options.add("offset_z", offset.z);
+    if (extra.size())
+    {
+        ++numVlrs;
+        pointOffset += vlrHeaderSize + extra.size() * extraBytesSize;
+    }
+
+    if (srs.size())
+    {
+        ++numVlrs;
+        pointOffset += vlrHeaderSize + srs.size() + 1;
+    }
 
-    if (m_metadata.srs().size()) options.add("a_srs", m_metadata.srs());
+    // The header is rewritten with its final values once all points have been
+    // compressed, so for now just reserve its space.
+    put(stream, std::string(), headerSize);
 
-    auto lock(Executor::getLock());
+    putVlrHeader(stream, "laszip encoded", 22204, laszipVlr.size(), "");
+    stream.write(
+            reinterpret_cast<const char*>(laszipVlr.data()),
+            laszipVlr.size());
 
-    pdal::LasWriter writer;
-    writer.setOptions(options);
-    writer.setInput(reader);
-    writer.prepare(table);
+    if (extra.size())
+    {
+        putVlrHeader(
+                stream,
+                "LASF_Spec",
+                4,
+                extra.size() * extraBytesSize,
+                "Extra bytes");
 
-    lock.unlock();
+        for (const auto& p : extra)
+        {
+            const DimInfo& dim(p.first);
+            put<uint16_t>(stream, 0);
+            put<uint8_t>(stream, extraBytesType(dim.type()));
+            put<uint8_t>(stream, 0);
+            put(stream, dim.name(), 32);
+
+            // Unused, no-data, min, max, scale, and offset fields.
+            put(stream, std::string(), 4 + 5 * 24);
+
+            put(stream, dim.name(), 32);
+        }
+    }
+
+    if (srs.size())
+    {
+        putVlrHeader(stream, "LASF_Projection", 2112, srs.size() + 1, "WKT");
+        put(stream, srs, srs.size() + 1);
+    }
+
+    assert(stream.tellp() == pointOffset);
+
+    BinaryPointTable table(schema);
+    const pdal::PointRef& pr(table.ref());
+
+    std::vector<char> record(format.pointSize());
+    std::array<int32_t, 3> xyz;
+    std::array<uint32_t, 5> returns { { 0, 0, 0, 0, 0 } };
+    Bounds bounds(Bounds::expander());
+    Point stored;
+
+    const char* end(buffer.data() + buffer.size());
+    for (const char* pos(buffer.data()); pos < end; pos += nativePointSize)
+    {
+        table.setPoint(pos);
+
+        for (std::size_t dim(0); dim < 3; ++dim)
+        {
+            const double native(
+                    Point::unscale(
+                        pr.getFieldAs<double>(xyzIds[dim]),
+                        scale[dim],
+                        delta.offset()[dim]));
+
+            xyz[dim] = std::llround(
+                    Point::scale(native, scale[dim], offset[dim]));
+
+            // The header bounds describe the values as they are stored.
+            stored[dim] = Point::unscale(xyz[dim], scale[dim], offset[dim]);
+        }
+
+        bounds.grow(stored);
+
+        const uint8_t ret(format.write(pr, pos, xyz, record.data()));
+        if (ret >= 1 && ret <= 5) ++returns[ret - 1];
+
+        compressor.compress(record.data());
+    }
+
+    if (np) compressor.done();
+
+    const auto date(creationDate());
+
+    stream.seekp(0);
+    put(stream, "LASF", 4);
+    put<uint16_t>(stream, 0);                           // File source ID.
+    put<uint16_t>(stream, srs.size() ? wktMask : 0);    // Global encoding.
+    put(stream, std::string(), 16);                     // GUID.
+    put<uint8_t>(stream, 1);
+    put<uint8_t>(stream, 4);
+    put(stream, "Entwine", 32);
+    put(stream, "Entwine " + currentVersion().toString(), 32);
+    put<uint16_t>(stream, date.first);
+    put<uint16_t>(stream, date.second);
+    put<uint16_t>(stream, headerSize);
+    put<uint32_t>(stream, pointOffset);
+    put<uint32_t>(stream, numVlrs);
+    put<uint8_t>(stream, format.id() | 0x80);
+    put<uint16_t>(stream, format.pointSize());
+    put<uint32_t>(stream, np);
+    for (const uint32_t n : returns) put<uint32_t>(stream, n);
+    for (std::size_t dim(0); dim < 3; ++dim) put<double>(stream, scale[dim]);
+    for (std::size_t dim(0); dim < 3; ++dim) put<double>(stream, offset[dim]);
+    for (std::size_t dim(0); dim < 3; ++dim)
+    {
+        put<double>(stream, np ? bounds.max()[dim] : 0.0);
+        put<double>(stream, np ? bounds.min()[dim] : 0.0);
+    }
 
-    writer.execute(table);
+    assert(stream.tellp() == legacyHeaderSize);
 
-    if (!local)
+    // LAS 1.4 additions: no waveform data or extended VLRs, and 64-bit point
+    // counts, of which only the first five returns may be populated by our
+    // point formats.
+    put<uint64_t>(stream, 0);
+    put<uint64_t>(stream, 0);
+    put<uint32_t>(stream, 0);
+    put<uint64_t>(stream, np);
+    for (std::size_t i(0); i < 15; ++i)
     {
-        ensurePut(out, filename + ".laz", tmp.getBinary(localFile));
-        arbiter::fs::remove(tmp.prefixedRoot() + localFile);
+        put<uint64_t>(stream, i < returns.size() ? returns[i] : 0);
     }
+
+    assert(stream.tellp() == headerSize);
+
+    if (!stream) throw std::runtime_error("Failed to write " + filename);
+    writeBuffer(out, tmp, filename + ".laz", std::move(data));
 }
 
-Cell::PooledStack Laz::read(
-        const arbiter::Endpoint& out,
-        const arbiter::Endpoint& tmp,
+Cell::PooledStack Laz::decode(
         PointPool& pool,
-        const std::string& filename) const
+        const std::string& filename,
+        const std::vector<char>& buffer) const
 {
-    const std::string basename(filename + ".laz");
-    std::string localFile(out.prefixedRoot() + basename);
-    bool copied(false);
+    const std::string basename(filename + extension());
 
-    if (!out.isLocal() && out.tryGetSize(basename))
+    if (
+            buffer.size() < legacyHeaderSize ||
+            std::string(buffer.data(), 4) != "LASF")
     {
-        localFile = arbiter::util::join(
-                tmp.prefixedRoot(),
-                arbiter::crypto::encodeAsHex(
-                    out.prefixedRoot()) + "-" + basename);
-        copied = true;
+        throw std::runtime_error("Invalid LAZ header: " + basename);
+    }
+
+    const char* data(buffer.data());
 
-        static const arbiter::drivers::Fs fs;
-        fs.put(localFile, *ensureGet(out, basename));
+    const uint16_t lasHeaderSize(get<uint16_t>(data + 94));
+    const uint32_t pointOffset(get<uint32_t>(data + 96));
+    const uint32_t numVlrs(get<uint32_t>(data + 100));
+    const uint8_t formatId(get<uint8_t>(data + 104));
+    const uint16_t lasPointSize(get<uint16_t>(data + 105));
+    const uint64_t np(get<uint32_t>(data + 107));
+
+    const Scale scale(
+            get<double>(data + 131),
+            get<double>(data + 139),
+            get<double>(data + 147));
+    const Offset offset(
+            get<double>(data + 155),
+            get<double>(data + 163),
+            get<double>(data + 171));
+
+    // The VLRs lie between the header and the point data, all of which must
+    // be within our buffer.
+    if (
+            lasHeaderSize < legacyHeaderSize ||
+            lasHeaderSize > pointOffset ||
+            pointOffset > buffer.size())
+    {
+        throw std::runtime_error("Invalid LAZ header: " + basename);
+    }
+
+    if (!(formatId & 0x80) || (formatId & 0x3F) > 3)
+    {
+        throw std::runtime_error("Unsupported LAZ point format: " + basename);
     }
 
-    CellTable table(pool, makeUnique<Schema>(Schema::normalize(pool.schema())));
+    const bool hasTime(formatId & 1);
+    const bool hasColor(formatId & 2);
+    const std::size_t lasBaseSize(
+            20 + (hasTime ? 8 : 0) + (hasColor ? 6 : 0));
 
-    if (auto preview = Executor::get().preview(localFile))
+    if (lasPointSize < lasBaseSize)
     {
-        table.resize(preview->numPoints);
+        throw std::runtime_error("Invalid LAZ point size: " + basename);
     }
 
-    const bool good(Executor::get().run(table, localFile));
-    if (copied) arbiter::fs::remove(localFile);
-    if (!good) throw std::runtime_error("Laszip read failure: " + localFile);
+    if (!pool.delta())
+    {
+        throw std::runtime_error("Laszip storage requires scaling.");
+    }
+
+    const Schema& schema(pool.schema());
+    const Delta& delta(*pool.delta());
+    const uint64_t nativePointSize(schema.pointSize());
+
+    const char* laszipVlr(nullptr);
+    std::vector<ExtraDim> extra;
+
+    const char* const vlrEnd(data + pointOffset);
+    const char* pos(data + lasHeaderSize);
+    for (uint32_t i(0); i < numVlrs; ++i)
+    {
+        if (vlrEnd - pos < vlrHeaderSize)
+        {
+            throw std::runtime_error("Invalid LAZ VLRs: " + basename);
+        }
+
+        const std::string userId(pos + 2, strnlen(pos + 2, 16));
+        const uint16_t recordId(get<uint16_t>(pos + 18));
+        const uint16_t length(get<uint16_t>(pos + 20));
+        const char* body(pos + vlrHeaderSize);
+
+        if (vlrEnd - body < length)
+        {
+            throw std::runtime_error("Invalid LAZ VLR length: " + basename);
+        }
+
+        if (userId == "laszip encoded" && recordId == 22204)
+        {
+            laszipVlr = body;
+        }
+        else if (userId == "LASF_Spec" && recordId == 4)
+        {
+            std::size_t lasOffset(lasBaseSize);
+            if (length % extraBytesSize)
+            {
+                throw std::runtime_error(
+                        "Invalid LAZ extra-bytes VLR: " + basename);
+            }
+
+            for (std::size_t j(0); j < length / extraBytesSize; ++j)
+            {
+                const char* record(body + j * extraBytesSize);
+                if (record + extraBytesSize > body + length)
+                {
+                    throw std::runtime_error(
+                            "Invalid LAZ extra-bytes VLR: " + basename);
+                }
+
+                const DimType type(extraBytesDimType(record[2]));
+                const std::string name(record + 4, strnlen(record + 4, 32));
+
+                if (schema.contains(name))
+                {
+                    const DimInfo& dim(schema.find(name));
+                    const auto* detail(
+                            schema.pdalLayout().dimDetail(dim.id()));
+                    extra.emplace_back(dim, detail->offset(), type);
+                    extra.back().lasOffset = lasOffset;
+                }
+
+                lasOffset += pdal::Dimension::size(type);
+                if (lasOffset > lasPointSize)
+                {
+                    throw std::runtime_error(
+                            "Invalid LAZ extra-bytes size: " + basename);
+                }
+            }
+        }
+
+        pos = body + length;
+    }
+
+    if (!laszipVlr) throw std::runtime_error("No laszip VLR: " + basename);
+    if (!np) return Cell::PooledStack(pool.cellPool());
+
+    Data::PooledStack dataStack(acquire(pool, np));
+
+    MemoryBuffer memoryBuffer(buffer);
+    std::istream stream(&memoryBuffer);
+    pdal::LazPerfVlrDecompressor decompressor(stream, laszipVlr, pointOffset);
+
+    BinaryPointTable table(schema);
+    pdal::PointRef& pr(table.ref());
+
+    auto set([&schema, &pr](DimId id, double v)
+    {
+        if (schema.contains(id)) pr.setField(id, v);
+    });
+
+    std::vector<char> record(lasPointSize);
+
+    for (char* native : dataStack)
+    {
+        decompressor.decompress(record.data());
+
+        const char* las(record.data());
+        std::fill(native, native + nativePointSize, 0);
+        table.setPoint(native);
+
+        for (std::size_t dim(0); dim < 3; ++dim)
+        {
+            const double v(
+                    Point::unscale(
+                        get<int32_t>(las + dim * 4),
+                        scale[dim],
+                        offset[dim]));
+
+            pr.setField(
+                    xyzIds[dim],
+                    std::llround(
+                        Point::scale(
+                            v,
+                            delta.scale()[dim],
+                            delta.offset()[dim])));
+        }
+
+        const uint8_t flags(get<uint8_t>(las + 14));
+
+        set(DimId::Intensity, get<uint16_t>(las + 12));
+        set(DimId::ReturnNumber, flags & 0x07);
+        set(DimId::NumberOfReturns, (flags >> 3) & 0x07);
+        set(DimId::ScanDirectionFlag, (flags >> 6) & 0x01);
+        set(DimId::EdgeOfFlightLine, (flags >> 7) & 0x01);
+        set(DimId::Classification, get<uint8_t>(las + 15));
+        set(DimId::ScanAngleRank, get<int8_t>(las + 16));
+        set(DimId::UserData, get<uint8_t>(las + 17));
+        set(DimId::PointSourceId, get<uint16_t>(las + 18));
+
+        const char* tail(las + 20);
+
+        if (hasTime)
+        {
+            set(DimId::GpsTime, get<double>(tail));
+            tail += 8;
+        }
+
+        if (hasColor)
+        {
+            set(DimId::Red, get<uint16_t>(tail));
+            set(DimId::Green, get<uint16_t>(tail + 2));
+            set(DimId::Blue, get<uint16_t>(tail + 4));
+        }
+
+        for (const ExtraDim& e : extra)
+        {
+            const char* src(las + e.lasOffset);
+
+            if (e.type == e.dim.type())
+            {
+                std::copy(src, src + e.dim.size(), native + e.nativeOffset);
+            }
+            else
+            {
+                pr.setField(e.dim.id(), getAs(e.type, src));
+            }
+        }
+    }
 
-    return table.acquire();
+    return getCells(pool, std::move(dataStack));
 }
 
 } // namespace entwine
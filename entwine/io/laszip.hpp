@@ -10,15 +10,20 @@
 
 #pragma once
 
-#include <entwine/io/io.hpp>
+#include <entwine/io/binary.hpp>
 
 namespace entwine
 {
 
-class Laz : public DataIo
+// LAZ chunks are encoded and decoded in memory to and from our native point
+// layout, without going through a PDAL pipeline or the filesystem.  Output is
+// LAS 1.4 with point format 0-3, depending on the presence of GpsTime and
+// color, and any remaining dimensions stored as extra bytes.  The SRS, if any,
+// is stored as WKT.
+class Laz : public Binary
 {
 public:
-    Laz(const Metadata& m) : DataIo(m) { }
+    Laz(const Metadata& m) : Binary(m) { }
 
     virtual std::string type() const override { return "laszip"; }
 
@@ -30,11 +35,15 @@ public:
             Cell::PooledStack&& cells,
             uint64_t np) const override;
 
-    virtual Cell::PooledStack read(
-            const arbiter::Endpoint& out,
-            const arbiter::Endpoint& tmp,
+    virtual Cell::PooledStack decode(
             PointPool& pointPool,
-            const std::string& filename) const override;
+            const std::string& filename,
+            const std::vector<char>& data) const override;
+
+    virtual bool compressed() const override { return true; }
+
+protected:
+    virtual std::string extension() const override { return ".laz"; }
 };
 
 } // namespace entwine
@@ -0,0 +1,46 @@
+/******************************************************************************
+* Copyright (c) 2018, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace entwine
+{
+
+// A private, read-only memory mapping of an entire local file.  Pages are
+// read lazily by the OS and may be shared with its page cache.  Any write to
+// the mapping faults, so it must only back points which are never modified.
+class MappedFile
+{
+public:
+    // Returns null if this file does not exist, is empty, or if mapping is
+    // not supported on this platform.
+    static std::unique_ptr<MappedFile> create(const std::string& path);
+
+    ~MappedFile();
+
+    char* data() const { return m_data; }
+    std::size_t size() const { return m_size; }
+
+private:
+    MappedFile(char* data, std::size_t size) : m_data(data), m_size(size) { }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    char* m_data;
+    std::size_t m_size;
+};
+
+} // namespace entwine
+
@@ -0,0 +1,408 @@
+/******************************************************************************
+* Copyright (c) 2018, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/io/packer.hpp>
+
+#include <fstream>
+#include <stdexcept>
+
+#include <entwine/io/ensure.hpp>
+#include <entwine/types/key.hpp>
+#include <entwine/util/json.hpp>
+#include <entwine/util/unique.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+    std::string packPath(const std::string& pack)
+    {
+        return "p/" + pack + ".pack";
+    }
+
+    std::string indexPath(const std::string& pack)
+    {
+        return "p/" + pack + ".json";
+    }
+
+    // The approximate overhead of each entry of a cached index.
+    const std::size_t indexNodeBytes(48);
+}
+
+void Packer::put(
+        const arbiter::Endpoint& out,
+        const arbiter::Endpoint& tmp,
+        const std::string& filename,
+        const std::vector<char>& data)
+{
+    if (!m_step)
+    {
+        ensurePut(out, filename, data);
+        return;
+    }
+
+    const bool packed(m_threshold && data.size() < m_threshold);
+    bool wasPending(false);
+
+    {
+        // Record each write before performing it, so a concurrent flush knows
+        // that its snapshot of this chunk is stale.
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const uint64_t version(++m_version);
+
+        if (packed)
+        {
+            m_pending[filename] = version;
+            m_loose.erase(filename);
+        }
+        else
+        {
+            wasPending = m_pending.erase(filename);
+            m_loose[filename] = version;
+        }
+    }
+
+    if (packed)
+    {
+        tmp.put(tmpName(out, filename), data);
+        return;
+    }
+
+    ensurePut(out, filename, data);
+
+    if (wasPending)
+    {
+        arbiter::fs::remove(tmp.prefixedRoot() + tmpName(out, filename));
+    }
+}
+
+std::vector<char> Packer::get(
+        const arbiter::Endpoint& out,
+        const arbiter::Endpoint& tmp,
+        const std::string& filename) const
+{
+    if (m_step)
+    {
+        bool pending(false);
+        bool loose(false);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            pending = m_pending.count(filename);
+            loose = m_loose.count(filename);
+        }
+
+        if (pending) return tmp.getBinary(tmpName(out, filename));
+
+        if (!loose)
+        {
+            const std::string pack(packOf(filename));
+            const auto packIndex(index(out, pack));
+            const auto it(packIndex->find(filename));
+
+            if (it != packIndex->end())
+            {
+                return getRange(out, packPath(pack), it->second);
+            }
+        }
+    }
+
+    return std::move(*ensureGet(out, filename));
+}
+
+std::unique_ptr<uint64_t> Packer::size(
+        const arbiter::Endpoint& out,
+        const arbiter::Endpoint& tmp,
+        const std::string& filename) const
+{
+    std::unique_ptr<std::size_t> size;
+
+    if (m_step)
+    {
+        bool pending(false);
+        bool loose(false);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            pending = m_pending.count(filename);
+            loose = m_loose.count(filename);
+        }
+
+        if (pending) size = tmp.tryGetSize(tmpName(out, filename));
+        else if (!loose)
+        {
+            const auto packIndex(index(out, packOf(filename)));
+            const auto it(packIndex->find(filename));
+
+            if (it != packIndex->end())
+            {
+                return makeUnique<uint64_t>(it->second.size);
+            }
+        }
+    }
+
+    if (!size) size = out.tryGetSize(filename);
+    if (!size) return std::unique_ptr<uint64_t>();
+    return makeUnique<uint64_t>(*size);
+}
+
+void Packer::flush(const arbiter::Endpoint& out, const arbiter::Endpoint& tmp)
+{
+    if (!m_step) return;
+
+    // Snapshot the chunks written since the last flush, and then rewrite
+    // their packs without holding our lock so reads and writes may proceed
+    // meanwhile.  Chunks written again after this snapshot are left for the
+    // next flush.
+    Versions pending;
+    Versions loose;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        pending = m_pending;
+        loose = m_loose;
+    }
+
+    std::set<std::string> packs;
+    for (const auto& p : pending) packs.insert(packOf(p.first));
+    for (const auto& p : loose) packs.insert(packOf(p.first));
+
+    std::map<std::string, std::shared_ptr<const Index>> indexes;
+
+    for (const std::string& pack : packs)
+    {
+        const Index previous(fetch(out, pack));
+
+        Index next;
+        std::vector<char> data;
+
+        auto append([&next, &data](
+                    const std::string& filename,
+                    const char* begin,
+                    const char* end)
+        {
+            next[filename] = Entry {
+                static_cast<uint64_t>(data.size()),
+                static_cast<uint64_t>(end - begin)
+            };
+            data.insert(data.end(), begin, end);
+        });
+
+        std::vector<char> previousData;
+        bool fetched(false);
+
+        for (const auto& p : previous)
+        {
+            const std::string& filename(p.first);
+            if (pending.count(filename) || loose.count(filename)) continue;
+
+            if (!fetched)
+            {
+                previousData = std::move(*ensureGet(out, packPath(pack)));
+                fetched = true;
+            }
+
+            const Entry& e(p.second);
+            if (e.offset + e.size > previousData.size())
+            {
+                throw std::runtime_error("Invalid pack: " + pack);
+            }
+
+            const char* begin(previousData.data() + e.offset);
+            append(filename, begin, begin + e.size);
+        }
+
+        for (const auto& p : pending)
+        {
+            const std::string& filename(p.first);
+            if (packOf(filename) != pack) continue;
+
+            // If this chunk has since been written individually, its tmp copy
+            // may be gone, and it no longer belongs in the pack anyway.
+            const auto chunk(tmp.tryGetBinary(tmpName(out, filename)));
+            if (!chunk) continue;
+
+            append(filename, chunk->data(), chunk->data() + chunk->size());
+        }
+
+        if (next.empty() && previous.empty()) continue;
+
+        Json::Value json(Json::objectValue);
+        for (const auto& p : next)
+        {
+            Json::Value& entry(json[p.first]);
+            entry.append(static_cast<Json::UInt64>(p.second.offset));
+            entry.append(static_cast<Json::UInt64>(p.second.size));
+        }
+
+        // Write the pack before its index, so any index we serve refers to
+        // data that exists.
+        ensurePut(out, packPath(pack), data);
+        ensurePut(out, indexPath(pack), toFastString(json));
+
+        indexes[pack] = std::make_shared<const Index>(std::move(next));
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const auto& p : indexes) cache(p.first, p.second, true);
+
+    // Chunks whose versions are unchanged since our snapshot are now packed.
+    // Their tmp copies are removed under the lock, since a newer write of the
+    // same chunk would replace them.
+    for (const auto& p : pending)
+    {
+        const auto it(m_pending.find(p.first));
+        if (it != m_pending.end() && it->second == p.second)
+        {
+            m_pending.erase(it);
+            arbiter::fs::remove(tmp.prefixedRoot() + tmpName(out, p.first));
+        }
+    }
+
+    for (const auto& p : loose)
+    {
+        const auto it(m_loose.find(p.first));
+        if (it != m_loose.end() && it->second == p.second) m_loose.erase(it);
+    }
+}
+
+std::string Packer::packOf(const std::string& filename) const
+{
+    const Dxyz dxyz(filename.substr(0, filename.find('.')));
+    const uint64_t depth(dxyz.d - dxyz.d % m_step);
+    const uint64_t shift(dxyz.d - depth);
+
+    return Xyz(dxyz.x >> shift, dxyz.y >> shift, dxyz.z >> shift)
+        .toString(depth);
+}
+
+std::string Packer::tmpName(
+        const arbiter::Endpoint& out,
+        const std::string& filename) const
+{
+    return arbiter::crypto::encodeAsHex(out.prefixedRoot()) + "-" + filename;
+}
+
+std::shared_ptr<const Packer::Index> Packer::index(
+        const arbiter::Endpoint& out,
+        const std::string& pack) const
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const auto it(m_indexes.find(pack));
+        if (it != m_indexes.end())
+        {
+            CachedIndex& cached(it->second);
+            m_indexOrder.splice(m_indexOrder.begin(), m_indexOrder, cached.it);
+            return cached.index;
+        }
+    }
+
+    // Fetch outside of the lock, so slow index fetches don't block reads of
+    // other packs.  If a flush cached a newer index meanwhile, keep that one.
+    auto fetched(std::make_shared<const Index>(fetch(out, pack)));
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return cache(pack, fetched, false);
+}
+
+std::shared_ptr<const Packer::Index> Packer::cache(
+        const std::string& pack,
+        std::shared_ptr<const Index> index,
+        const bool replace) const
+{
+    auto it(m_indexes.find(pack));
+    if (it != m_indexes.end())
+    {
+        CachedIndex& cached(it->second);
+        m_indexOrder.splice(m_indexOrder.begin(), m_indexOrder, cached.it);
+        if (!replace) return cached.index;
+
+        m_indexBytes -= cached.bytes;
+    }
+    else
+    {
+        it = m_indexes.emplace(pack, CachedIndex()).first;
+        m_indexOrder.push_front(pack);
+        it->second.it = m_indexOrder.begin();
+    }
+
+    CachedIndex& cached(it->second);
+    cached.index = std::move(index);
+    cached.bytes = pack.size() + sizeof(CachedIndex);
+    for (const auto& p : *cached.index)
+    {
+        cached.bytes += p.first.size() + sizeof(Entry) + indexNodeBytes;
+    }
+    m_indexBytes += cached.bytes;
+
+    // Never evict the index being returned.  Evicted indexes remain valid for
+    // any callers still holding them.
+    while (m_indexBytes > m_maxIndexBytes && m_indexOrder.size() > 1)
+    {
+        const auto victim(m_indexes.find(m_indexOrder.back()));
+        m_indexBytes -= victim->second.bytes;
+        m_indexes.erase(victim);
+        m_indexOrder.pop_back();
+    }
+
+    return cached.index;
+}
+
+Packer::Index Packer::fetch(
+        const arbiter::Endpoint& out,
+        const std::string& pack)
+{
+    // A pack without an index contains nothing.
+    Index index;
+
+    if (auto s = out.tryGet(indexPath(pack)))
+    {
+        const Json::Value json(parse(*s));
+        for (const std::string& key : json.getMemberNames())
+        {
+            index[key] = Entry {
+                json[key][0].asUInt64(),
+                json[key][1].asUInt64()
+            };
+        }
+    }
+
+    return index;
+}
+
+std::vector<char> Packer::getRange(
+        const arbiter::Endpoint& out,
+        const std::string& path,
+        const Entry& entry)
+{
+    std::vector<char> data(entry.size);
+    if (data.empty()) return data;
+
+    if (out.isLocal())
+    {
+        std::ifstream file(out.fullPath(path), std::ios::in | std::ios::binary);
+        file.seekg(entry.offset);
+        file.read(data.data(), data.size());
+
+        if (!file || file.gcount() != static_cast<std::streamsize>(data.size()))
+        {
+            throw std::runtime_error("Could not read packed range: " + path);
+        }
+
+        return data;
+    }
+
+    return ensureGetRange(out, path, entry.offset, entry.size);
+}
+
+} // namespace entwine
+
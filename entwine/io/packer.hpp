@@ -0,0 +1,150 @@
+/******************************************************************************
+* Copyright (c) 2018, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <entwine/builder/heuristics.hpp>
+#include <entwine/third/arbiter/arbiter.hpp>
+
+namespace entwine
+{
+
+// Stores small chunks in pack files rather than as individual objects.  Each
+// chunk belongs to the pack of its ancestor at the nearest shallower depth
+// which is a multiple of the pack step, and each pack has a JSON index
+// mapping chunk filenames to their byte ranges within it.  Chunks which are
+// not found in the index of their pack are stored individually.
+//
+// While building, small chunks are written to the tmp endpoint and are only
+// packed when flushed, so they may be rewritten freely beforehand.
+class Packer
+{
+public:
+    // A step of zero disables packing entirely.  A threshold of zero allows
+    // reading from existing packs, but no new chunks will be packed.
+    Packer(
+            uint64_t threshold,
+            uint64_t step,
+            std::size_t maxIndexBytes = heuristics::packIndexBytes)
+        : m_threshold(threshold)
+        , m_step(step)
+        , m_maxIndexBytes(maxIndexBytes)
+    { }
+
+    uint64_t threshold() const { return m_threshold; }
+    uint64_t step() const { return m_step; }
+
+    // The approximate size of the pack indexes currently cached.
+    std::size_t indexBytes() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_indexBytes;
+    }
+
+    void put(
+            const arbiter::Endpoint& out,
+            const arbiter::Endpoint& tmp,
+            const std::string& filename,
+            const std::vector<char>& data);
+
+    std::vector<char> get(
+            const arbiter::Endpoint& out,
+            const arbiter::Endpoint& tmp,
+            const std::string& filename) const;
+
+    // The size of the data which get would return, from the pack index if
+    // this chunk is packed, or else from a size request.  Returns null if
+    // this chunk does not exist.
+    std::unique_ptr<uint64_t> size(
+            const arbiter::Endpoint& out,
+            const arbiter::Endpoint& tmp,
+            const std::string& filename) const;
+
+    // Rewrite the packs containing any chunks written since the last flush.
+    // The rewrite does not block reads or writes, but chunks written while it
+    // is in progress are left pending until the next flush.
+    void flush(const arbiter::Endpoint& out, const arbiter::Endpoint& tmp);
+
+private:
+    struct Entry
+    {
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    using Index = std::map<std::string, Entry>;
+
+    struct CachedIndex
+    {
+        std::shared_ptr<const Index> index;
+        std::size_t bytes = 0;
+        std::list<std::string>::iterator it;
+    };
+
+    // Maps chunk filenames to the version of their most recent write.
+    using Versions = std::map<std::string, uint64_t>;
+
+    std::string packOf(const std::string& filename) const;
+    std::string tmpName(
+            const arbiter::Endpoint& out,
+            const std::string& filename) const;
+
+    std::shared_ptr<const Index> index(
+            const arbiter::Endpoint& out,
+            const std::string& pack) const;
+
+    // Cache this index, replacing any existing one only if requested, and
+    // return the cached index.  Must be called with our lock held.
+    std::shared_ptr<const Index> cache(
+            const std::string& pack,
+            std::shared_ptr<const Index> index,
+            bool replace) const;
+
+    static Index fetch(const arbiter::Endpoint& out, const std::string& pack);
+
+    static std::vector<char> getRange(
+            const arbiter::Endpoint& out,
+            const std::string& path,
+            const Entry& entry);
+
+    const uint64_t m_threshold;
+    const uint64_t m_step;
+    const std::size_t m_maxIndexBytes;
+
+    mutable std::mutex m_mutex;
+
+    uint64_t m_version = 0;
+
+    // Chunks currently residing in the tmp endpoint awaiting a flush.
+    Versions m_pending;
+
+    // Chunks written individually since the last flush, which supersede any
+    // packed entries for them.
+    Versions m_loose;
+
+    // Pack indexes are fetched on first access and retained in a least
+    // recently used cache bounded by their approximate size in memory.  Every
+    // cached index matches the one stored, so evicted ones may be refetched.
+    mutable std::map<std::string, CachedIndex> m_indexes;
+    mutable std::list<std::string> m_indexOrder;
+    mutable std::size_t m_indexBytes = 0;
+};
+
+} // namespace entwine
+
@@ -0,0 +1,183 @@
+/******************************************************************************
+* Copyright (c) 2018, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/io/write-queue.hpp>
+
+#include <limits>
+#include <stdexcept>
+
+#include <entwine/io/packer.hpp>
+#include <entwine/util/pool.hpp>
+
+namespace entwine
+{
+
+WriteQueue::WriteQueue(Packer& packer)
+    : m_packer(packer)
+{ }
+
+WriteQueue::~WriteQueue()
+{
+    if (m_pool) m_pool->join();
+}
+
+void WriteQueue::start(const std::size_t threads, const uint64_t maxBytes)
+{
+    if (m_pool || !threads) return;
+
+    m_maxBytes = maxBytes;
+
+    // Backpressure is determined by the byte limit rather than by the number
+    // of queued tasks.
+    m_pool.reset(new Pool(threads, std::numeric_limits<std::size_t>::max()));
+}
+
+void WriteQueue::await()
+{
+    if (m_pool) m_pool->await();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_error.size())
+    {
+        const std::string error(m_error);
+        m_error.clear();
+        throw std::runtime_error("Chunk upload failure: " + error);
+    }
+}
+
+void WriteQueue::put(
+        const arbiter::Endpoint& out,
+        const arbiter::Endpoint& tmp,
+        const std::string& filename,
+        std::vector<char> data)
+{
+    if (!m_pool)
+    {
+        m_packer.put(out, tmp, filename, data);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_stats.uploaded;
+        m_stats.uploadedBytes += data.size();
+        return;
+    }
+
+    const uint64_t size(data.size());
+    Buffer buffer(std::make_shared<const std::vector<char>>(std::move(data)));
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [this, size]()
+    {
+        return m_pending.empty() || m_stats.pendingBytes + size <= m_maxBytes;
+    });
+
+    auto it(m_pending.find(filename));
+    if (it != m_pending.end())
+    {
+        // An upload task already exists for this chunk, and will pick up this
+        // newer version once it finishes its current upload.
+        Pending& pending(it->second);
+        m_stats.pendingBytes -= pending.data->size();
+        m_stats.pendingBytes += size;
+        pending.data = buffer;
+        ++pending.version;
+
+        // The pending total may have shrunk, so let blocked writers recheck.
+        lock.unlock();
+        m_cv.notify_all();
+        return;
+    }
+
+    Pending& pending(m_pending[filename]);
+    pending.data = buffer;
+    ++m_stats.pending;
+    m_stats.pendingBytes += size;
+
+    lock.unlock();
+
+    m_pool->add([this, &out, &tmp, filename]()
+    {
+        upload(out, tmp, filename);
+    });
+}
+
+std::vector<char> WriteQueue::get(
+        const arbiter::Endpoint& out,
+        const arbiter::Endpoint& tmp,
+        const std::string& filename) const
+{
+    Buffer buffer;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const auto it(m_pending.find(filename));
+        if (it != m_pending.end()) buffer = it->second.data;
+    }
+
+    if (buffer) return *buffer;
+    return m_packer.get(out, tmp, filename);
+}
+
+WriteQueue::Stats WriteQueue::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+void WriteQueue::upload(
+        const arbiter::Endpoint& out,
+        const arbiter::Endpoint& tmp,
+        const std::string& filename)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (true)
+    {
+        const Buffer buffer(m_pending.at(filename).data);
+        const uint64_t version(m_pending.at(filename).version);
+
+        lock.unlock();
+
+        std::string error;
+
+        try
+        {
+            m_packer.put(out, tmp, filename, *buffer);
+        }
+        catch (std::exception& e) { error = e.what(); }
+        catch (...) { error = "Unknown error"; }
+
+        lock.lock();
+
+        const auto it(m_pending.find(filename));
+
+        if (error.empty())
+        {
+            ++m_stats.uploaded;
+            m_stats.uploadedBytes += buffer->size();
+
+            if (it->second.version != version) continue;
+        }
+        else if (m_error.empty())
+        {
+            m_error = filename + ": " + error;
+        }
+
+        m_stats.pendingBytes -= it->second.data->size();
+        --m_stats.pending;
+        m_pending.erase(it);
+
+        lock.unlock();
+        m_cv.notify_all();
+        return;
+    }
+}
+
+} // namespace entwine
+
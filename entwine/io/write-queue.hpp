@@ -0,0 +1,106 @@
+/******************************************************************************
+* Copyright (c) 2018, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <entwine/third/arbiter/arbiter.hpp>
+
+namespace entwine
+{
+
+class Packer;
+class Pool;
+
+// Decouples the storage of serialized chunks from their encoding.  Once
+// started, writes are queued and uploaded by a dedicated pool of threads, so
+// encoder threads may continue as long as the total size of pending uploads
+// remains under a byte limit, after which writers block.  Reads of chunks with
+// pending uploads are served from memory.
+//
+// Until started, writes are performed synchronously.  Once started, a failed
+// upload is not reported by put, but only by the next call to await.
+class WriteQueue
+{
+public:
+    struct Stats
+    {
+        // Uploads currently queued or in progress.
+        std::size_t pending = 0;
+        uint64_t pendingBytes = 0;
+
+        // Completed uploads.
+        std::size_t uploaded = 0;
+        uint64_t uploadedBytes = 0;
+    };
+
+    WriteQueue(Packer& packer);
+    ~WriteQueue();
+
+    void start(std::size_t threads, uint64_t maxBytes);
+
+    // Wait for all pending uploads to complete.  If any of them failed, the
+    // first failure is rethrown.
+    void await();
+
+    // Queue this chunk for upload, or upload it now if not started.  Errors
+    // from queued uploads are deferred until await.
+    void put(
+            const arbiter::Endpoint& out,
+            const arbiter::Endpoint& tmp,
+            const std::string& filename,
+            std::vector<char> data);
+
+    std::vector<char> get(
+            const arbiter::Endpoint& out,
+            const arbiter::Endpoint& tmp,
+            const std::string& filename) const;
+
+    Stats stats() const;
+
+private:
+    using Buffer = std::shared_ptr<const std::vector<char>>;
+
+    struct Pending
+    {
+        Buffer data;
+        uint64_t version = 0;
+    };
+
+    void upload(
+            const arbiter::Endpoint& out,
+            const arbiter::Endpoint& tmp,
+            const std::string& filename);
+
+    Packer& m_packer;
+    std::unique_ptr<Pool> m_pool;
+    uint64_t m_maxBytes = 0;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+
+    // At most one upload task exists for each filename.  If a chunk is
+    // rewritten while its upload is in progress, that task uploads it again
+    // with the newer data.
+    std::map<std::string, Pending> m_pending;
+
+    Stats m_stats;
+    std::string m_error;
+};
+
+} // namespace entwine
+
@@ -10,12 +10,53 @@
 
 #include <entwine/io/zstandard.hpp>
 
-#include <pdal/compression/ZstdCompression.hpp>
+#include <stdexcept>
+
+#ifdef ENTWINE_ZSTD
+#include <zstd.h>
+#endif
 
 namespace entwine
 {
 
-/*
+namespace
+{
+#ifdef ENTWINE_ZSTD
+    const int level(3);
+
+    std::size_t check(const std::size_t code, const std::string& message)
+    {
+        if (ZSTD_isError(code))
+        {
+            throw std::runtime_error(message + ": " + ZSTD_getErrorName(code));
+        }
+        return code;
+    }
+
+    class DStream
+    {
+    public:
+        DStream() : m_stream(ZSTD_createDStream())
+        {
+            if (!m_stream) throw std::runtime_error("Zstandard init failure");
+            check(ZSTD_initDStream(m_stream), "Zstandard init failure");
+        }
+
+        ~DStream() { ZSTD_freeDStream(m_stream); }
+
+        ZSTD_DStream* get() { return m_stream; }
+
+    private:
+        ZSTD_DStream* m_stream;
+    };
+#else
+    void unavailable()
+    {
+        throw std::runtime_error("Entwine was built without Zstandard support");
+    }
+#endif
+}
+
 void Zstandard::write(
         const arbiter::Endpoint& out,
         const arbiter::Endpoint& tmp,
@@ -24,40 +65,162 @@ void Zstandard::write(
         Cell::PooledStack&& cells,
         const uint64_t np) const
 {
+#ifdef ENTWINE_ZSTD
     const auto uncompressed(getBuffer(cells, np));
+    pointPool.release(std::move(cells));
 
-    std::vector<char> compressed;
-    pdal::ZstdCompressor compressor([&compressed](char* pos, std::size_t size)
-    {
-        compressed.insert(compressed.end(), pos, pos + size);
-    });
+    std::vector<char> compressed(ZSTD_compressBound(uncompressed.size()));
 
-    compressor.compress(uncompressed.data(), uncompressed.size());
-    compressor.done();
+    // A single-pass compression writes the content size into the frame header.
+    const std::size_t size(
+            ZSTD_compress(
+                compressed.data(),
+                compressed.size(),
+                uncompressed.data(),
+                uncompressed.size(),
+                level));
 
-    writeBuffer(out, filename + ".zst", compressed);
+    check(size, "Zstandard compression failure");
+    compressed.resize(size);
+
+    writeBuffer(out, tmp, filename + ".zst", std::move(compressed));
+#else
+    unavailable();
+#endif
 }
 
-Cell::PooledStack Zstandard::read(
-        const arbiter::Endpoint& out,
-        const arbiter::Endpoint& tmp,
+Cell::PooledStack Zstandard::decode(
         PointPool& pool,
-        const std::string& filename) const
+        const std::string& filename,
+        const std::vector<char>& compressed) const
 {
-    std::vector<char> uncompressed;
-    const auto compressed(getBuffer(out, filename + ".zst"));
+#ifdef ENTWINE_ZSTD
+    // One-shot decompression fails unless the input is made up entirely of
+    // frames whose content fits exactly within the size from the header.
+    const unsigned long long size(
+            ZSTD_getFrameContentSize(compressed.data(), compressed.size()));
+
+    if (size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN)
+    {
+        throw std::runtime_error("Invalid Zstandard frame: " + filename);
+    }
 
-    pdal::ZstdDecompressor dec([&uncompressed](char* pos, std::size_t size)
+    const uint64_t pointSize(m_metadata.schema().pointSize());
+    if (size % pointSize)
     {
-        uncompressed.insert(uncompressed.end(), pos, pos + size);
-    });
+        throw std::runtime_error("Invalid Zstandard data size: " + filename);
+    }
+
+    const uint64_t np(size / pointSize);
+
+    if (pool.schema() != m_metadata.schema())
+    {
+        // Decompress the native points, and then copy out only the
+        // dimensions we want.
+        std::vector<char> native(size);
+        const std::size_t result(
+                ZSTD_decompress(
+                    native.data(),
+                    size,
+                    compressed.data(),
+                    compressed.size()));
+
+        check(result, "Zstandard decompression failure");
+        if (result != size)
+        {
+            throw std::runtime_error("Invalid Zstandard result: " + filename);
+        }
+
+        return getCells(pool, native.data(), np);
+    }
+
+    Data::PooledStack dataStack(acquire(pool, np));
+
+    if (char* dst = contiguous(dataStack))
+    {
+        // Decompress straight into the pooled block, which our cells will
+        // reference in place.
+        const std::size_t result(
+                ZSTD_decompress(
+                    dst,
+                    size,
+                    compressed.data(),
+                    compressed.size()));
+
+        check(result, "Zstandard decompression failure");
+        if (result != size)
+        {
+            throw std::runtime_error("Invalid Zstandard result: " + filename);
+        }
+    }
+    else
+    {
+        // Our nodes are scattered throughout the pool, so stream into each of
+        // them in turn.
+        DStream stream;
+        ZSTD_inBuffer in { compressed.data(), compressed.size(), 0 };
+
+        // Nonzero until the frame has been completely decoded.
+        std::size_t remaining(1);
+
+        for (char* data : dataStack)
+        {
+            ZSTD_outBuffer dst { data, pointSize, 0 };
+
+            while (dst.pos < dst.size)
+            {
+                const std::size_t consumed(in.pos);
+                const std::size_t produced(dst.pos);
+
+                remaining = check(
+                        ZSTD_decompressStream(stream.get(), &dst, &in),
+                        "Zstandard decompression failure");
+
+                if (in.pos == consumed && dst.pos == produced)
+                {
+                    throw std::runtime_error(
+                            "Truncated Zstandard data: " + filename);
+                }
+            }
+        }
+
+        // Every point has been filled, but the end of the frame may not have
+        // been read yet.  It must not hold any more data.
+        char extra(0);
+        while (remaining)
+        {
+            ZSTD_outBuffer dst { &extra, 1, 0 };
+            const std::size_t consumed(in.pos);
+
+            remaining = check(
+                    ZSTD_decompressStream(stream.get(), &dst, &in),
+                    "Zstandard decompression failure");
+
+            if (dst.pos)
+            {
+                throw std::runtime_error(
+                        "Invalid Zstandard result: " + filename);
+            }
+
+            if (remaining && in.pos == consumed)
+            {
+                throw std::runtime_error(
+                        "Truncated Zstandard data: " + filename);
+            }
+        }
 
-    dec.decompress(compressed.data(), compressed.size());
-    dec.done();
+        if (in.pos != in.size)
+        {
+            throw std::runtime_error("Trailing Zstandard data: " + filename);
+        }
+    }
 
-    return getCells(pool, uncompressed);
+    return getCells(pool, std::move(dataStack));
+#else
+    unavailable();
+    return Cell::PooledStack(pool.cellPool());
+#endif
 }
-*/
 
 } // namespace entwine
 
@@ -8,11 +8,16 @@
 *
 ******************************************************************************/
 
+#pragma once
+
 #include <entwine/io/binary.hpp>
 
 namespace entwine
 {
 
+// Each chunk is stored as a single Zstandard frame of the sorted binary point
+// data.  Since frames are compressed in one pass, the decompressed size is
+// always present in the frame header, so reads know the point count up front.
 class Zstandard : public Binary
 {
 public:
@@ -20,7 +25,6 @@ public:
 
     virtual std::string type() const override { return "zstandard"; }
 
-    /*
     virtual void write(
             const arbiter::Endpoint& out,
             const arbiter::Endpoint& tmp,
@@ -29,12 +33,15 @@ public:
             Cell::PooledStack&& cells,
             uint64_t np) const override;
 
-    virtual Cell::PooledStack read(
-            const arbiter::Endpoint& out,
-            const arbiter::Endpoint& tmp,
+    virtual Cell::PooledStack decode(
             PointPool& pointPool,
-            const std::string& filename) const override;
-    */
+            const std::string& filename,
+            const std::vector<char>& data) const override;
+
+    virtual bool compressed() const override { return true; }
+
+protected:
+    virtual std::string extension() const override { return ".zst"; }
 };
 
 } // namespace entwine
@@ -10,78 +10,392 @@
 
 #include <entwine/reader/cache.hpp>
 
+#include <algorithm>
+#include <functional>
+
+#include <entwine/io/io.hpp>
 #include <entwine/reader/reader.hpp>
 
 namespace entwine
 {
 
+namespace
+{
+    const std::size_t sketchDepth(4);
+    const uint8_t maxCount(15);
+
+    // Counters are halved after this many additions per column.
+    const std::size_t sketchPeriod(10);
+
+    uint64_t mix(uint64_t v)
+    {
+        v ^= v >> 33;
+        v *= 0xff51afd7ed558ccdULL;
+        v ^= v >> 33;
+        v *= 0xc4ceb9fe1a85ec53ULL;
+        v ^= v >> 33;
+        return v;
+    }
+
+    uint64_t hash(const GlobalId& id)
+    {
+        uint64_t h(std::hash<std::string>()(id.path));
+        h = mix(h ^ std::hash<std::string>()(id.projection));
+        h = mix(h ^ id.key.d);
+        h = mix(h ^ id.key.p.x);
+        h = mix(h ^ id.key.p.y);
+        return mix(h ^ id.key.p.z);
+    }
+
+    std::string projection(const Schema& schema)
+    {
+        std::string s;
+        for (const DimInfo& dim : schema.dims()) s += dim.name() + ",";
+        return s;
+    }
+} // unnamed namespace
+
 bool operator<(const GlobalId& a, const GlobalId& b)
 {
-    return a.path < b.path || (a.path == b.path && a.key < b.key);
+    if (a.path != b.path) return a.path < b.path;
+    if (a.key != b.key) return a.key < b.key;
+    return a.projection < b.projection;
+}
+
+FrequencySketch::FrequencySketch(const std::size_t width)
+    : m_width(width)
+    , m_counters(width * sketchDepth, 0)
+{ }
+
+std::size_t FrequencySketch::index(const uint64_t hash, std::size_t row) const
+{
+    return row * m_width + mix(hash + row * 0x9e3779b97f4a7c15ULL) % m_width;
+}
+
+void FrequencySketch::add(const uint64_t hash)
+{
+    for (std::size_t row(0); row < sketchDepth; ++row)
+    {
+        uint8_t& c(m_counters[index(hash, row)]);
+        if (c < maxCount) ++c;
+    }
+
+    if (++m_additions >= m_width * sketchPeriod)
+    {
+        for (uint8_t& c : m_counters) c /= 2;
+        m_additions /= 2;
+    }
+}
+
+uint64_t FrequencySketch::estimate(const uint64_t hash) const
+{
+    uint64_t result(maxCount);
+    for (std::size_t row(0); row < sketchDepth; ++row)
+    {
+        result = std::min<uint64_t>(result, m_counters[index(hash, row)]);
+    }
+    return result;
+}
+
+Cache::Cache(const std::size_t maxBytes, const std::size_t maxCompressedBytes)
+    : m_maxBytes(maxBytes)
+    , m_maxCompressedBytes(maxCompressedBytes)
+{ }
+
+Cache::Stats Cache::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
 }
 
 std::deque<SharedChunkReader> Cache::acquire(
         const Reader& reader,
-        const std::vector<Dxyz>& keys)
+        const std::vector<Dxyz>& keys,
+        const Schema& schema)
 {
+    const std::string p(projection(schema));
+
+    std::vector<std::shared_future<SharedChunkReader>> futures;
+    std::vector<Load> loads;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const Dxyz& key : keys)
+        {
+            futures.push_back(get(GlobalId(reader.path(), key, p), loads));
+        }
+    }
+
+    for (Load& l : loads) load(reader, l, schema);
+
     std::deque<SharedChunkReader> block;
+    for (auto& f : futures) block.push_back(f.get());
+
+    return block;
+}
+
+void Cache::prefetch(
+        const Reader& reader,
+        const std::vector<Dxyz>& keys,
+        const Schema& schema,
+        Pool& pool)
+{
+    const std::string p(projection(schema));
+    std::vector<Load> loads;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const Dxyz& key : keys)
+        {
+            // Chunks which are already present are left alone, so that
+            // prefetching does not affect their recency.
+            const GlobalId id(reader.path(), key, p);
+            if (m_chunks.count(id)) continue;
+
+            ++m_stats.prefetches;
+            loads.push_back(insert(id));
+            loads.back().it->second.prefetched = true;
+        }
+    }
 
+    if (loads.empty()) return;
+
+    // These loads may outlive the caller's schema.
+    const auto s(std::make_shared<Schema>(schema));
+
+    for (const Load& l : loads)
+    {
+        pool.add([this, &reader, l, s]() mutable { load(reader, l, *s); });
+    }
+}
+
+bool Cache::resident(
+        const Reader& reader,
+        const Dxyz& key,
+        const Schema& schema) const
+{
     std::lock_guard<std::mutex> lock(m_mutex);
-    for (const Dxyz& key : keys) block.push_back(get(reader, key));
+    return
+        m_chunks.count(GlobalId(reader.path(), key, projection(schema))) ||
+        m_compressed.count(GlobalId(reader.path(), key));
+}
+
+Cache::Load Cache::insert(const GlobalId& id)
+{
+    auto it(m_chunks.insert(std::make_pair(id, ChunkReaderInfo())).first);
 
-    purge();
+    Load l;
+    l.it = it;
+    l.promise = std::make_shared<std::promise<SharedChunkReader>>();
 
-    return block;
+    ChunkReaderInfo& info(it->second);
+    info.chunk = l.promise->get_future().share();
+    m_order.push_front(it);
+    info.it = m_order.begin();
+
+    return l;
 }
 
-SharedChunkReader Cache::get(const Reader& reader, const Dxyz& key)
+std::shared_future<SharedChunkReader> Cache::get(
+        const GlobalId& id,
+        std::vector<Load>& loads)
 {
-    const GlobalId id(reader.path(), key);
+    m_sketch.add(hash(id));
 
     auto it(m_chunks.find(id));
 
     if (it == m_chunks.end())
     {
-        it = m_chunks.insert(std::make_pair(id, ChunkReaderInfo())).first;
+        ++m_stats.misses;
+        loads.push_back(insert(id));
+        return loads.back().it->second.chunk;
+    }
+
+    ++m_stats.hits;
 
-        ChunkReaderInfo& info(it->second);
-        info.chunk = std::make_shared<ChunkReader>(reader, key);
-        m_size += info.chunk->cells().size() * reader.pointSize();
+    ChunkReaderInfo& info(it->second);
+    info.prefetched = false;
+    m_order.splice(m_order.begin(), m_order, info.it);
+    return info.chunk;
+}
+
+void Cache::load(const Reader& reader, Load& l, const Schema& schema)
+{
+    SharedChunkReader chunk;
+
+    try
+    {
+        chunk = decode(reader, l.it->first, schema);
     }
-    else
+    catch (...)
     {
-        ChunkReaderInfo& info(it->second);
-        m_order.erase(info.it);
+        l.promise->set_exception(std::current_exception());
+
+        // Don't cache the failure, so a later request may retry.
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_order.erase(l.it->second.it);
+        m_chunks.erase(l.it);
+        return;
     }
 
-    m_order.push_front(it);
+    l.promise->set_value(chunk);
 
-    ChunkReaderInfo& info(it->second);
-    info.it = m_order.begin();
+    // A size of zero marks a chunk that is still loading, so empty chunks are
+    // given a nominal size.
+    std::lock_guard<std::mutex> lock(m_mutex);
+    l.it->second.bytes = std::max<std::size_t>(chunk->bytes(), 1);
 
-    return info.chunk;
+    if (admit(l.it)) purge();
 }
 
-void Cache::purge()
+SharedChunkReader Cache::decode(
+        const Reader& reader,
+        const GlobalId& id,
+        const Schema& schema)
 {
-    const std::size_t start(m_size);
-    while (m_size > m_maxBytes)
+    const DataIo& io(reader.metadata().dataIo());
+
+    if (!io.compressed() || !m_maxCompressedBytes)
     {
-        const auto& it(m_order.back());
-        const GlobalId& id(it->first);
-        const ChunkReaderInfo& info(it->second);
+        return std::make_shared<ChunkReader>(reader, id.key, schema);
+    }
+
+    // The stored bytes are shared by every projection of this chunk.
+    const GlobalId stored(id.path, id.key);
+
+    if (const auto data = findCompressed(stored))
+    {
+        return std::make_shared<ChunkReader>(reader, id.key, schema, *data);
+    }
+
+    const std::shared_ptr<const std::vector<char>> data(
+            std::make_shared<std::vector<char>>(
+                io.fetch(reader.ep(), reader.tmp(), id.key.toString())));
+
+    SharedChunkReader chunk(
+            std::make_shared<ChunkReader>(reader, id.key, schema, *data));
+
+    insertCompressed(stored, data);
+    return chunk;
+}
+
+std::shared_ptr<const std::vector<char>> Cache::findCompressed(
+        const GlobalId& id)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it(m_compressed.find(id));
+    if (it == m_compressed.end()) return nullptr;
+
+    ++m_stats.compressedHits;
 
-        std::cout << "\tDele " << id.key << std::endl;
-        m_size -= info.chunk->cells().size() * info.chunk->pointSize();
-        m_order.pop_back();
+    CompressedInfo& info(it->second);
+    m_compressedOrder.splice(
+            m_compressedOrder.begin(),
+            m_compressedOrder,
+            info.it);
+
+    return info.data;
+}
+
+void Cache::insertCompressed(
+        const GlobalId& id,
+        std::shared_ptr<const std::vector<char>> data)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    const std::size_t bytes(data->size());
+    if (m_compressed.count(id) || bytes > m_maxCompressedBytes) return;
+
+    // The same admission policy as the hot tier, against the least recently
+    // used compressed chunk.
+    if (
+            m_stats.compressedBytes + bytes > m_maxCompressedBytes &&
+            !m_compressedOrder.empty())
+    {
+        const GlobalId& victim(m_compressedOrder.back()->first);
+        if (m_sketch.estimate(hash(id)) <= m_sketch.estimate(hash(victim)))
+        {
+            ++m_stats.compressedRejections;
+            return;
+        }
+    }
+
+    auto it(m_compressed.insert(std::make_pair(id, CompressedInfo())).first);
+    it->second.data = std::move(data);
+    m_compressedOrder.push_front(it);
+    it->second.it = m_compressedOrder.begin();
+    m_stats.compressedBytes += bytes;
+
+    while (m_stats.compressedBytes > m_maxCompressedBytes)
+    {
+        const auto victim(m_compressedOrder.back());
+        m_stats.compressedBytes -= victim->second.data->size();
+        m_compressedOrder.pop_back();
+        m_compressed.erase(victim);
+        ++m_stats.compressedEvictions;
+    }
+}
+
+bool Cache::admit(const ChunkReaderInfo::Map::iterator it)
+{
+    const std::size_t bytes(it->second.bytes);
+
+    if (it->second.prefetched && m_stats.bytes + bytes > m_maxBytes)
+    {
+        ++m_stats.rejections;
+        m_order.erase(it->second.it);
         m_chunks.erase(it);
+        return false;
     }
 
-    if (start > m_size)
+    if (m_stats.bytes + bytes > m_maxBytes)
     {
-        std::cout << "\t\tPurged " << (start - m_size) << std::endl;
+        // Find the least recently used chunk which has finished loading.
+        auto pos(m_order.end());
+        while (pos != m_order.begin())
+        {
+            --pos;
+
+            const auto victim(*pos);
+            if (victim == it || !victim->second.bytes) continue;
+
+            const uint64_t candidate(m_sketch.estimate(hash(it->first)));
+            if (candidate <= m_sketch.estimate(hash(victim->first)))
+            {
+                // Callers already waiting on this chunk still receive it.
+                ++m_stats.rejections;
+                m_order.erase(it->second.it);
+                m_chunks.erase(it);
+                return false;
+            }
+
+            break;
+        }
     }
+
+    m_stats.bytes += bytes;
+    return true;
 }
 
-} // namespace entwine
+void Cache::purge()
+{
+    // Chunks which are still loading have no size yet, so they are skipped.
+    // Evicted chunks remain valid for any queries still holding them.
+    auto pos(m_order.end());
+    while (m_stats.bytes > m_maxBytes && pos != m_order.begin())
+    {
+        --pos;
+
+        const auto it(*pos);
+        const ChunkReaderInfo& info(it->second);
+        if (!info.bytes) continue;
+
+        ++m_stats.evictions;
+        m_stats.bytes -= info.bytes;
+        pos = m_order.erase(pos);
+        m_chunks.erase(it);
+    }
+}
 
+} // namespace entwine
@@ -11,28 +11,42 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
 #include <deque>
+#include <future>
 #include <list>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <vector>
 
+#include <entwine/builder/heuristics.hpp>
 #include <entwine/reader/chunk-reader.hpp>
 #include <entwine/types/key.hpp>
+#include <entwine/util/pool.hpp>
 
 namespace entwine
 {
 
 class Reader;
 
+// Decoded chunks are identified by the dimensions into which they were
+// decoded, as well as by their dataset and key.  The stored bytes of a chunk
+// are the same regardless, so those are identified with an empty projection.
 struct GlobalId
 {
-    GlobalId(const std::string path, const Dxyz& key)
+    GlobalId(
+            const std::string path,
+            const Dxyz& key,
+            const std::string projection = "")
         : path(path)
         , key(key)
+        , projection(projection)
     { }
 
     const std::string path;
     const Dxyz key;
+    const std::string projection;
 };
 
 bool operator<(const GlobalId& a, const GlobalId& b);
@@ -42,34 +56,161 @@ struct ChunkReaderInfo
     using Map = std::map<GlobalId, ChunkReaderInfo>;
     using Order = std::list<Map::iterator>;
 
-    SharedChunkReader chunk;
+    // While this chunk is being loaded, its size is zero.
+    std::shared_future<SharedChunkReader> chunk;
+    std::size_t bytes = 0;
     Order::iterator it;
+
+    // Prefetched chunks have not been requested yet, so they have no
+    // frequency with which to displace others.  Until they are requested,
+    // they are only retained if they fit without evicting anything.
+    bool prefetched = false;
+};
+
+struct CompressedInfo
+{
+    using Map = std::map<GlobalId, CompressedInfo>;
+    using Order = std::list<Map::iterator>;
+
+    std::shared_ptr<const std::vector<char>> data;
+    Order::iterator it;
+};
+
+// An approximate count of recent accesses to each chunk, used to decide
+// whether a newly loaded chunk is worth more than the one it would evict.
+// This is a count-min sketch of small saturating counters which are all
+// halved periodically, so popularity decays over time.
+class FrequencySketch
+{
+public:
+    explicit FrequencySketch(std::size_t width = 4096);
+
+    void add(uint64_t hash);
+    uint64_t estimate(uint64_t hash) const;
+
+private:
+    std::size_t index(uint64_t hash, std::size_t row) const;
+
+    const std::size_t m_width;
+    std::vector<uint8_t> m_counters;
+    std::size_t m_additions = 0;
 };
 
+// Decoded chunks are held in a hot tier, bounded by maxBytes.  For compressed
+// data types, the stored bytes of chunks are also held in a second tier,
+// bounded by maxCompressedBytes, so that chunks evicted from the hot tier may
+// be decoded again without being fetched.  Stored chunks are typically several
+// times smaller than decoded ones, so by default the second tier holds more
+// chunks than the hot tier despite its smaller byte limit.
+//
+// Admission to a full hot tier follows TinyLFU: a newly loaded chunk only
+// displaces the least recently used chunk if it has been requested more
+// frequently.  So a single large scan, whose chunks are each requested once,
+// passes through without flushing the working set.
 class Cache
 {
 public:
-    Cache(std::size_t maxBytes = 1024 * 1024 * 1024) // TODO default.
-        : m_maxBytes(maxBytes)
-    { }
+    Cache(
+            std::size_t maxBytes = heuristics::cacheBytes,
+            std::size_t maxCompressedBytes = heuristics::cacheCompressedBytes);
 
     std::size_t maxBytes() const { return m_maxBytes; }
-
+    std::size_t maxCompressedBytes() const { return m_maxCompressedBytes; }
+
+    // Chunks are loaded outside of the cache lock.  Concurrent requests for
+    // the same chunk share a single load, and different chunks may be loaded
+    // in parallel.
+    //
+    // Chunks are decoded into the given schema, and are only shared between
+    // requests for the same schema.
     std::deque<SharedChunkReader> acquire(
             const Reader& reader,
-            const std::vector<Dxyz>& keys);
+            const std::vector<Dxyz>& keys,
+            const Schema& schema);
+
+    // Begin loading these chunks on the given pool, if they are not already
+    // cached or loading, without waiting for them.
+    void prefetch(
+            const Reader& reader,
+            const std::vector<Dxyz>& keys,
+            const Schema& schema,
+            Pool& pool);
+
+    // Returns true if reading this chunk into the given schema would not
+    // require fetching it, either because it is decoded or loading in the hot
+    // tier, or because its stored bytes are in the compressed tier.  This
+    // does not count as a request.
+    bool resident(
+            const Reader& reader,
+            const Dxyz& key,
+            const Schema& schema) const;
+
+    struct Stats
+    {
+        // Requests for chunks in the hot tier, including those still loading.
+        uint64_t hits = 0;
+
+        // Requests for chunks not in the hot tier, some of which are decoded
+        // from the compressed tier without being fetched.
+        uint64_t misses = 0;
+        uint64_t compressedHits = 0;
+
+        // Chunks loaded by prefetching, which are not counted as requests.
+        uint64_t prefetches = 0;
+
+        // Chunks which were loaded but not admitted to each tier.
+        uint64_t rejections = 0;
+        uint64_t compressedRejections = 0;
+
+        uint64_t evictions = 0;
+        uint64_t compressedEvictions = 0;
+
+        std::size_t bytes = 0;
+        std::size_t compressedBytes = 0;
+    };
+
+    Stats stats() const;
 
 private:
-    SharedChunkReader get(const Reader& reader, const Dxyz& id);
+    struct Load
+    {
+        ChunkReaderInfo::Map::iterator it;
+        std::shared_ptr<std::promise<SharedChunkReader>> promise;
+    };
+
+    Load insert(const GlobalId& id);
+    std::shared_future<SharedChunkReader> get(
+            const GlobalId& id,
+            std::vector<Load>& loads);
+    void load(const Reader& reader, Load& load, const Schema& schema);
+
+    SharedChunkReader decode(
+            const Reader& reader,
+            const GlobalId& id,
+            const Schema& schema);
+    std::shared_ptr<const std::vector<char>> findCompressed(
+            const GlobalId& id);
+    void insertCompressed(
+            const GlobalId& id,
+            std::shared_ptr<const std::vector<char>> data);
+
+    // Returns true if this chunk, which has finished loading, is retained.
+    bool admit(ChunkReaderInfo::Map::iterator it);
     void purge();
 
-    const std::size_t m_maxBytes = 1024 * 1024;
+    const std::size_t m_maxBytes;
+    const std::size_t m_maxCompressedBytes;
 
     mutable std::mutex m_mutex;
-    std::size_t m_size = 0;
+    Stats m_stats;
+
+    FrequencySketch m_sketch;
 
     ChunkReaderInfo::Map m_chunks;
     ChunkReaderInfo::Order m_order;
+
+    CompressedInfo::Map m_compressed;
+    CompressedInfo::Order m_compressedOrder;
 };
 
 } // namespace entwine
@@ -12,19 +12,131 @@
 
 #include <entwine/io/io.hpp>
 #include <entwine/reader/reader.hpp>
+#include <entwine/types/point-sort.hpp>
 
 namespace entwine
 {
 
-ChunkReader::ChunkReader(const Reader& r, const Dxyz& id)
-    : m_pointPool(r.metadata().schema(), r.metadata().delta(), 4096)
+namespace
+{
+    const uint64_t mortonBits(10);
+
+    // Spread the low 10 bits of v so that there are two zero bits between
+    // each of them.
+    uint64_t spread(uint64_t v)
+    {
+        v &= 0x3ff;
+        v = (v | (v << 16)) & 0x030000ff;
+        v = (v | (v << 8)) & 0x0300f00f;
+        v = (v | (v << 4)) & 0x030c30c3;
+        v = (v | (v << 2)) & 0x09249249;
+        return v;
+    }
+
+    uint64_t quantize(double v, double min, double width)
+    {
+        const double max((1 << mortonBits) - 1);
+        if (width <= 0) return 0;
+        return std::min(max, std::max(0.0, (v - min) / width * max));
+    }
+} // unnamed namespace
+
+constexpr std::size_t ChunkReader::blockSize;
+
+ChunkReader::Overlap ChunkReader::overlap(
+        const Bounds& q,
+        const Bounds& b)
+{
+    // Block extents, unlike chunk bounds, may be flat, so they are compared
+    // inclusively while the query bounds are half-open like
+    // Bounds::contains(Point).
+    const bool z(q.is3d());
+
+    if (
+            b.max().x < q.min().x || b.min().x >= q.max().x ||
+            b.max().y < q.min().y || b.min().y >= q.max().y ||
+            (z && (b.max().z < q.min().z || b.min().z >= q.max().z)))
+    {
+        return Overlap::None;
+    }
+
+    if (
+            b.min().x >= q.min().x && b.max().x < q.max().x &&
+            b.min().y >= q.min().y && b.max().y < q.max().y &&
+            (!z || (b.min().z >= q.min().z && b.max().z < q.max().z)))
+    {
+        return Overlap::All;
+    }
+
+    return Overlap::Partial;
+}
+
+ChunkReader::ChunkReader(const Reader& r, const Dxyz& id, const Schema& s)
+    : m_schema(s)
+    , m_pointPool(m_schema, r.metadata().delta(), 4096, true)
     , m_cells(r.metadata().dataIo().read(
                 r.ep(),
                 r.tmp(),
                 m_pointPool,
                 id.toString()))
-    , m_pointSize(r.metadata().schema().pointSize())
-{ }
+    , m_pointSize(m_schema.pointSize())
+{
+    index();
+}
+
+ChunkReader::ChunkReader(
+        const Reader& r,
+        const Dxyz& id,
+        const Schema& s,
+        const std::vector<char>& data)
+    : m_schema(s)
+    , m_pointPool(m_schema, r.metadata().delta(), 4096, true)
+    , m_cells(r.metadata().dataIo().decode(m_pointPool, id.toString(), data))
+    , m_pointSize(m_schema.pointSize())
+{
+    index();
+}
+
+void ChunkReader::index()
+{
+    m_sorted.reserve(m_cells.size());
+
+    Bounds extents(Bounds::expander());
+    for (const Cell& cell : m_cells)
+    {
+        m_sorted.push_back(&cell);
+        extents.grow(cell.point());
+    }
+
+    if (m_sorted.empty()) return;
+
+    const Point& origin(extents.min());
+    std::vector<detail::SortKey> keys(m_sorted.size());
+
+    for (std::size_t i(0); i < m_sorted.size(); ++i)
+    {
+        const Point& p(m_sorted[i]->point());
+        keys[i].key =
+            (spread(quantize(p.x, origin.x, extents.width())) << 2) |
+            (spread(quantize(p.y, origin.y, extents.depth())) << 1) |
+            spread(quantize(p.z, origin.z, extents.height()));
+        keys[i].index = i;
+    }
+
+    detail::radixSort(keys);
+
+    std::vector<const Cell*> sorted;
+    sorted.reserve(m_sorted.size());
+    for (const detail::SortKey& k : keys) sorted.push_back(m_sorted[k.index]);
+    m_sorted.swap(sorted);
+
+    m_blocks.reserve((m_sorted.size() + blockSize - 1) / blockSize);
+    for (std::size_t i(0); i < m_sorted.size(); ++i)
+    {
+        if (i % blockSize == 0) m_blocks.push_back(Bounds::expander());
+        m_blocks.back().grow(m_sorted[i]->point());
+    }
+}
 
 } // namespace entwine
 
@@ -11,9 +11,12 @@
 #pragma once
 
 #include <memory>
+#include <vector>
 
+#include <entwine/types/bounds.hpp>
 #include <entwine/types/key.hpp>
 #include <entwine/types/point-pool.hpp>
+#include <entwine/types/schema.hpp>
 
 namespace entwine
 {
@@ -23,19 +26,60 @@ class Reader;
 class ChunkReader
 {
 public:
-    ChunkReader(const Reader& reader, const Dxyz& id);
+    // Points are decoded into the given schema, which must consist of X, Y,
+    // and Z along with any subset of the other dimensions of the dataset.
+    ChunkReader(const Reader& reader, const Dxyz& id, const Schema& schema);
+
+    // Decode from stored bytes which have already been fetched.
+    ChunkReader(
+            const Reader& reader,
+            const Dxyz& id,
+            const Schema& schema,
+            const std::vector<char>& data);
+
     ~ChunkReader()
     {
         m_pointPool.release(std::move(m_cells));
     }
 
+    const Schema& schema() const { return m_schema; }
     const Cell::PooledStack& cells() const { return m_cells; }
     uint64_t pointSize() const { return m_pointSize; }
 
+    // The cells in Morton order, split into consecutive blocks of blockSize
+    // cells.  The bounds of each block are the exact extents of its points,
+    // so spatially limited queries may skip or accept whole blocks.
+    static constexpr std::size_t blockSize = 64;
+
+    const std::vector<const Cell*>& sorted() const { return m_sorted; }
+    const std::vector<Bounds>& blocks() const { return m_blocks; }
+
+    enum class Overlap { None, Partial, All };
+
+    // Compare the inclusive extents of some points, which may be flat in any
+    // dimension, with half-open query bounds.  If the result is None or All,
+    // then the points need not be checked individually.
+    static Overlap overlap(const Bounds& query, const Bounds& extents);
+
+    // Total size in memory, including the spatial index.
+    std::size_t bytes() const
+    {
+        return m_cells.size() * m_pointSize +
+            m_sorted.size() * sizeof(const Cell*) +
+            m_blocks.size() * sizeof(Bounds);
+    }
+
 private:
+    void index();
+
+    // Our pool refers to this schema, so it must be declared first.
+    const Schema m_schema;
     PointPool m_pointPool;
     Cell::PooledStack m_cells;
     uint64_t m_pointSize;
+
+    std::vector<const Cell*> m_sorted;
+    std::vector<Bounds> m_blocks;
 };
 
 using SharedChunkReader = std::shared_ptr<ChunkReader>;
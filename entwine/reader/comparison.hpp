@@ -10,6 +10,9 @@
 
 #pragma once
 
+#include <cmath>
+#include <cstdint>
+#include <unordered_set>
 #include <vector>
 
 #include <entwine/reader/filterable.hpp>
@@ -111,6 +114,13 @@ public:
 
     virtual bool operator()(double in) const = 0;
     virtual bool operator()(const Bounds& bounds) const { return true; }
+
+    // Returns false only if no value within these statistics can pass.
+    virtual bool operator()(const DimStats& stats) const { return true; }
+
+    // Returns a mask of the values in this column which pass, where bit i
+    // corresponds to in[i].  At most 64 values may be given.
+    virtual uint64_t operator()(const double* in, std::size_t n) const = 0;
     virtual void log(const std::string& pre) const = 0;
 
     virtual std::vector<Origin> origins() const
@@ -140,11 +150,37 @@ public:
         return m_op(in, m_val);
     }
 
+    virtual uint64_t operator()(const double* in, std::size_t n) const
+        override
+    {
+        uint64_t mask(0);
+        for (std::size_t i(0); i < n; ++i)
+        {
+            mask |= static_cast<uint64_t>(m_op(in[i], m_val)) << i;
+        }
+        return mask;
+    }
+
     virtual bool operator()(const Bounds& bounds) const override
     {
         return !m_bounds || m_bounds->overlaps(bounds.growBy(.005));
     }
 
+    virtual bool operator()(const DimStats& stats) const override
+    {
+        switch (m_type)
+        {
+            case ComparisonType::eq: return stats.mayContain(m_val);
+            case ComparisonType::gt: return stats.max() > m_val;
+            case ComparisonType::gte: return stats.max() >= m_val;
+            case ComparisonType::lt: return stats.min() < m_val;
+            case ComparisonType::lte: return stats.min() <= m_val;
+            case ComparisonType::ne:
+                return stats.min() != m_val || stats.max() != m_val;
+            default: return true;
+        }
+    }
+
     virtual void log(const std::string& pre) const override
     {
         std::cout << pre << toString(m_type) << " " << m_val;
@@ -165,6 +201,44 @@ protected:
     std::unique_ptr<Bounds> m_bounds;
 };
 
+// Set membership for $in and $nin.  Small non-negative integral values, which
+// is the common case for dimensions like Classification, are looked up in a
+// bitset, and any others in a hash set.
+class ValueSet
+{
+public:
+    ValueSet(const std::vector<double>& vals)
+    {
+        for (const double d : vals)
+        {
+            if (d >= 0 && d < maxBit && std::floor(d) == d)
+            {
+                const uint64_t v(d);
+                if (v / 64 >= m_bits.size()) m_bits.resize(v / 64 + 1, 0);
+                m_bits[v / 64] |= 1ULL << (v % 64);
+            }
+            else m_others.insert(d == 0 ? 0.0 : d);
+        }
+    }
+
+    bool contains(double d) const
+    {
+        if (d >= 0 && d < m_bits.size() * 64 && std::floor(d) == d)
+        {
+            const uint64_t v(d);
+            return m_bits[v / 64] & (1ULL << (v % 64));
+        }
+
+        return !m_others.empty() && m_others.count(d == 0 ? 0.0 : d);
+    }
+
+private:
+    static constexpr double maxBit = 65536;
+
+    std::vector<uint64_t> m_bits;
+    std::unordered_set<double> m_others;
+};
+
 class ComparisonMulti : public ComparisonOperator
 {
 public:
@@ -174,6 +248,7 @@ public:
             const std::vector<Bounds>& boundsList)
         : ComparisonOperator(type)
         , m_vals(vals)
+        , m_set(vals)
         , m_boundsList(boundsList)
     { }
 
@@ -190,7 +265,18 @@ public:
     }
 
 protected:
+    uint64_t select(const double* in, std::size_t n) const
+    {
+        uint64_t mask(0);
+        for (std::size_t i(0); i < n; ++i)
+        {
+            mask |= static_cast<uint64_t>(m_set.contains(in[i])) << i;
+        }
+        return mask;
+    }
+
     std::vector<double> m_vals;
+    ValueSet m_set;
     std::vector<Bounds> m_boundsList;
 };
 
@@ -205,10 +291,23 @@ public:
 
     virtual bool operator()(double in) const override
     {
-        return std::any_of(m_vals.begin(), m_vals.end(), [in](double val)
+        return m_set.contains(in);
+    }
+
+    virtual uint64_t operator()(const double* in, std::size_t n) const
+        override
+    {
+        return select(in, n);
+    }
+
+    virtual bool operator()(const DimStats& stats) const override
+    {
+        for (const double d : m_vals)
         {
-            return in == val;
-        });
+            if (stats.mayContain(d)) return true;
+        }
+
+        return false;
     }
 
     virtual bool operator()(const Bounds& bounds) const override
@@ -237,10 +336,33 @@ public:
 
     virtual bool operator()(double in) const override
     {
-        return std::none_of(m_vals.begin(), m_vals.end(), [in](double val)
+        return !m_set.contains(in);
+    }
+
+    virtual uint64_t operator()(const double* in, std::size_t n) const
+        override
+    {
+        const uint64_t all(n == 64 ? ~0ULL : (1ULL << n) - 1);
+        return ~select(in, n) & all;
+    }
+
+    // A chunk may be skipped only if every value within it is excluded.
+    virtual bool operator()(const DimStats& stats) const override
+    {
+        if (!stats.exact())
+        {
+            return stats.min() != stats.max() || !m_set.contains(stats.min());
+        }
+
+        for (uint64_t v(0); v < 64; ++v)
         {
-            return in == val;
-        });
+            if ((stats.values() & (1ULL << v)) && !m_set.contains(v))
+            {
+                return true;
+            }
+        }
+
+        return false;
     }
 };
 
@@ -282,6 +404,19 @@ public:
         return (*m_op)(bounds);
     }
 
+    bool check(const ChunkStats& stats) const override
+    {
+        const auto it(stats.find(m_dim));
+        return it == stats.end() || (*m_op)(it->second);
+    }
+
+    uint64_t check(const FilterBlock& block) const override
+    {
+        return (*m_op)(block.column(m_dim), block.size());
+    }
+
+    pdal::Dimension::Id dim() const { return m_dim; }
+
     virtual void log(const std::string& pre) const override
     {
         std::cout << pre << m_name << " ";
@@ -0,0 +1,78 @@
+/******************************************************************************
+* Copyright (c) 2018, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/reader/filter-block.hpp>
+
+#include <cstring>
+#include <stdexcept>
+
+#include <entwine/types/schema.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+    template<typename T>
+    void extract(
+            const char* const* points,
+            const std::size_t size,
+            const std::size_t offset,
+            double* out)
+    {
+        T v;
+        for (std::size_t i(0); i < size; ++i)
+        {
+            std::memcpy(&v, points[i] + offset, sizeof(T));
+            out[i] = v;
+        }
+    }
+} // unnamed namespace
+
+const double* FilterBlock::column(const pdal::Dimension::Id id) const
+{
+    for (std::size_t i(0); i < m_numColumns; ++i)
+    {
+        if (m_columns[i].id == id) return m_columns[i].values.data();
+    }
+
+    if (m_numColumns == m_columns.size()) m_columns.emplace_back();
+    Column& column(m_columns[m_numColumns++]);
+    column.id = id;
+
+    const auto* dim(m_schema.pdalLayout().dimDetail(id));
+    if (!dim) throw std::runtime_error("Invalid filter dimension");
+
+    const char* const* p(m_points.data());
+    const std::size_t o(dim->offset());
+    double* out(column.values.data());
+
+    using Type = pdal::Dimension::Type;
+
+    switch (dim->type())
+    {
+        case Type::Double:      extract<double>(p, m_size, o, out);     break;
+        case Type::Float:       extract<float>(p, m_size, o, out);      break;
+        case Type::Unsigned8:   extract<uint8_t>(p, m_size, o, out);    break;
+        case Type::Signed8:     extract<int8_t>(p, m_size, o, out);     break;
+        case Type::Unsigned16:  extract<uint16_t>(p, m_size, o, out);   break;
+        case Type::Signed16:    extract<int16_t>(p, m_size, o, out);    break;
+        case Type::Unsigned32:  extract<uint32_t>(p, m_size, o, out);   break;
+        case Type::Signed32:    extract<int32_t>(p, m_size, o, out);    break;
+        case Type::Unsigned64:  extract<uint64_t>(p, m_size, o, out);   break;
+        case Type::Signed64:    extract<int64_t>(p, m_size, o, out);    break;
+        default: throw std::runtime_error("Invalid filter dimension type");
+    }
+
+    return out;
+}
+
+} // namespace entwine
+
@@ -0,0 +1,79 @@
+/******************************************************************************
+* Copyright (c) 2018, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <pdal/Dimension.hpp>
+
+namespace entwine
+{
+
+class Schema;
+
+// A block of up to 64 points to be filtered together.  Filters select points
+// from a block with a bitmask, in which bit i corresponds to point i.
+//
+// Dimension values are extracted from the points as contiguous columns of
+// doubles on first use, so each dimension is read at most once per block and
+// comparisons may run as simple vectorizable loops over these columns.
+class FilterBlock
+{
+public:
+    static std::size_t capacity() { return 64; }
+
+    explicit FilterBlock(const Schema& schema) : m_schema(schema) { }
+
+    void push(const char* point) { m_points[m_size++] = point; }
+    void clear()
+    {
+        m_size = 0;
+        m_numColumns = 0;
+    }
+
+    std::size_t size() const { return m_size; }
+    bool empty() const { return !m_size; }
+    bool full() const { return m_size == capacity(); }
+
+    const char* point(std::size_t i) const { return m_points[i]; }
+
+    // A mask selecting every point in this block.
+    uint64_t all() const
+    {
+        return m_size == capacity() ? ~0ULL : (1ULL << m_size) - 1;
+    }
+
+    // The values of this dimension for each point.  The result is valid until
+    // another column is extracted or the block is cleared.
+    const double* column(pdal::Dimension::Id id) const;
+
+private:
+    struct Column
+    {
+        pdal::Dimension::Id id;
+        std::array<double, 64> values;
+    };
+
+    const Schema& m_schema;
+
+    std::array<const char*, 64> m_points;
+    std::size_t m_size = 0;
+
+    // Column storage is retained across blocks to avoid reallocating it.
+    mutable std::vector<Column> m_columns;
+    mutable std::size_t m_numColumns = 0;
+};
+
+} // namespace entwine
+
@@ -10,6 +10,7 @@
 
 #pragma once
 
+#include <set>
 #include <string>
 
 #include <json/json.h>
@@ -56,6 +57,22 @@ public:
         return m_queryBounds.overlaps(bounds) && m_root.check(bounds);
     }
 
+    bool check(const ChunkStats& stats) const
+    {
+        return m_root.check(stats);
+    }
+
+    uint64_t check(const FilterBlock& block) const
+    {
+        return m_root.check(block);
+    }
+
+    // True if no filter was given, so every point passes.
+    bool empty() const { return m_root.empty(); }
+
+    // The dimensions compared by this filter.
+    const std::set<pdal::Dimension::Id>& dims() const { return m_dims; }
+
     void log() const
     {
         m_root.log("");
@@ -89,8 +106,7 @@ private:
                 else if (!val.isObject() || val.size() == 1)
                 {
                     // a comparison query object.
-                    active->push(
-                            Comparison::create(m_metadata, key, val, delta));
+                    push(*active, key, val, delta);
                 }
                 else
                 {
@@ -107,12 +123,7 @@ private:
                     {
                         Json::Value next;
                         next[innerKey] = val[innerKey];
-                        active->push(
-                                Comparison::create(
-                                    m_metadata,
-                                    key,
-                                    next,
-                                    delta));
+                        push(*active, key, next, delta);
                     }
                 }
             }
@@ -130,9 +141,21 @@ private:
         }
     }
 
+    void push(
+            LogicGate& gate,
+            const std::string& name,
+            const Json::Value& json,
+            const Delta* delta)
+    {
+        auto comparison(Comparison::create(m_metadata, name, json, delta));
+        m_dims.insert(comparison->dim());
+        gate.push(std::move(comparison));
+    }
+
     const Metadata& m_metadata;
     const Bounds m_queryBounds;
     LogicalAnd m_root;
+    std::set<pdal::Dimension::Id> m_dims;
 };
 
 } // namespace entwine
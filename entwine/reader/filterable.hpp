@@ -11,11 +11,14 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
 #include <string>
 
 #include <pdal/PointRef.hpp>
 
+#include <entwine/reader/filter-block.hpp>
 #include <entwine/types/bounds.hpp>
+#include <entwine/types/chunk-stats.hpp>
 
 namespace entwine
 {
@@ -25,6 +28,13 @@ class Filterable
 public:
     virtual bool check(const pdal::PointRef& pointRef) const = 0;
     virtual bool check(const Bounds& bounds) const { return true; }
+
+    // Returns false only if no point in a chunk with these statistics can
+    // pass.  Dimensions without statistics are assumed to pass.
+    virtual bool check(const ChunkStats& stats) const { return true; }
+
+    // Returns the mask of the points in this block which pass.
+    virtual uint64_t check(const FilterBlock& block) const = 0;
     virtual void log(const std::string& pre) const = 0;
 };
 
@@ -0,0 +1,237 @@
+/******************************************************************************
+* Copyright (c) 2018, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#include <entwine/reader/hierarchy-reader.hpp>
+
+#include <limits>
+#include <set>
+
+#include <entwine/util/unique.hpp>
+
+namespace entwine
+{
+
+namespace
+{
+    const std::size_t prefetchThreads(8);
+}
+
+HierarchyReader::HierarchyReader(
+        const Metadata& metadata,
+        const arbiter::Endpoint& out,
+        const std::size_t maxBytes)
+    : m_metadata(metadata)
+    , m_ep(out.getSubEndpoint("h"))
+    , m_step(m_metadata.hierarchyStep())
+    , m_maxBytes(maxBytes)
+    , m_pool(
+            makeUnique<Pool>(
+                prefetchThreads,
+                std::numeric_limits<std::size_t>::max(),
+                false))
+{ }
+
+uint64_t HierarchyReader::count(const Dxyz& p) const
+{
+    if (const Page data = page(resident(p))) return data->file->count(p);
+    else return 0;
+}
+
+std::shared_ptr<const ChunkStats> HierarchyReader::stats(const Dxyz& p) const
+{
+    if (m_metadata.chunkStats().empty()) return nullptr;
+
+    const Page data(page(resident(p)));
+    if (!data) return nullptr;
+
+    const auto it(data->stats.find(p));
+    if (it == data->stats.end()) return nullptr;
+
+    // Share ownership of the page, which may be evicted while in use.
+    return std::shared_ptr<const ChunkStats>(data, &it->second);
+}
+
+void HierarchyReader::prefetch(const std::vector<Dxyz>& nodes) const
+{
+    std::set<Dxyz> roots;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const Dxyz& node : nodes)
+        {
+            const Dxyz root(resident(node));
+            if (!m_pages.count(root)) roots.insert(root);
+        }
+    }
+
+    // Each call waits only for its own pages, since the pool is shared with
+    // any concurrent queries.
+    std::vector<std::future<void>> futures;
+    for (const Dxyz& root : roots)
+    {
+        auto task(
+                std::make_shared<std::packaged_task<void()>>(
+                    [this, root]() { page(root); }));
+        futures.push_back(task->get_future());
+
+        if (roots.size() < 2) (*task)();
+        else m_pool->add([task]() { (*task)(); });
+    }
+
+    for (auto& f : futures)
+    {
+        try
+        {
+            f.get();
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ++m_prefetchErrors;
+        }
+    }
+}
+
+std::size_t HierarchyReader::bytes() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_bytes;
+}
+
+uint64_t HierarchyReader::prefetchErrors() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_prefetchErrors;
+}
+
+Dxyz HierarchyReader::resident(const Dxyz& node) const
+{
+    if (!m_step || node.depth() <= m_step) return Dxyz();
+
+    const uint64_t residentDepth((node.depth() - 1) / m_step * m_step);
+    const uint64_t offset(node.depth() - residentDepth);
+    return Dxyz(
+            residentDepth,
+            node.p.x >> offset,
+            node.p.y >> offset,
+            node.p.z >> offset);
+}
+
+HierarchyReader::Page HierarchyReader::page(const Dxyz& root) const
+{
+    std::shared_future<Page> future;
+    std::promise<Page> promise;
+    bool owner(false);
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto it(m_pages.find(root));
+        if (it != m_pages.end())
+        {
+            Entry& entry(it->second);
+            m_order.splice(m_order.begin(), m_order, entry.it);
+            future = entry.page;
+        }
+        else
+        {
+            owner = true;
+            future = promise.get_future().share();
+
+            Entry& entry(m_pages[root]);
+            entry.page = future;
+            m_order.push_front(root);
+            entry.it = m_order.begin();
+        }
+    }
+
+    if (!owner) return future.get();
+
+    // A page only exists if its root node exists in its parent page, so check
+    // that before fetching anything.
+    Page result;
+    std::size_t bytes(sizeof(Entry));
+
+    try
+    {
+        if (!root.depth() || count(root))
+        {
+            auto data(std::make_shared<PageData>());
+            data->file = HierarchyFile::load(
+                    m_metadata.hierarchyType(),
+                    m_ep,
+                    root.toString());
+            bytes += data->file->bytes();
+
+            // Statistics files are absent if they were not recorded when
+            // this page was built.
+            const std::string f(root.toString() + ".stats.json");
+            const auto s(
+                    m_metadata.chunkStats().size() ?
+                        m_ep.tryGet(f) : std::unique_ptr<std::string>());
+
+            if (s)
+            {
+                const Json::Value json(parse(*s));
+                for (const std::string& k : json.getMemberNames())
+                {
+                    ChunkStats& stats(data->stats[Dxyz(k)]);
+                    stats = toChunkStats(json[k], m_metadata.schema());
+                    bytes += sizeof(Dxyz) +
+                        stats.size() * (sizeof(DimStats) + 32);
+                }
+            }
+
+            result = data;
+        }
+    }
+    catch (...)
+    {
+        promise.set_exception(std::current_exception());
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it(m_pages.find(root));
+        m_order.erase(it->second.it);
+        m_pages.erase(it);
+        throw;
+    }
+
+    promise.set_value(result);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pages.at(root).bytes = bytes;
+    m_bytes += bytes;
+    purge(root);
+
+    return result;
+}
+
+void HierarchyReader::purge(const Dxyz& keep) const
+{
+    // Pages still being fetched have no size yet and are skipped.  Evicted
+    // pages remain valid for any callers still holding them.
+    auto it(m_order.end());
+    while (m_bytes > m_maxBytes && it != m_order.begin())
+    {
+        --it;
+
+        auto page(m_pages.find(*it));
+        const Entry& entry(page->second);
+
+        if (!entry.bytes || *it == keep) continue;
+
+        m_bytes -= entry.bytes;
+        m_pages.erase(page);
+        it = m_order.erase(it);
+    }
+}
+
+} // namespace entwine
+
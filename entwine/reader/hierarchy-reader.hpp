@@ -10,12 +10,20 @@
 
 #pragma once
 
-#include <cassert>
 #include <cstdint>
-
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <entwine/io/hierarchy-file.hpp>
 #include <entwine/third/arbiter/arbiter.hpp>
+#include <entwine/types/chunk-stats.hpp>
 #include <entwine/types/key.hpp>
 #include <entwine/util/json.hpp>
+#include <entwine/util/pool.hpp>
 
 namespace entwine
 {
@@ -25,69 +33,76 @@ class Node
 public:
 };
 
+// Hierarchy pages - the individual hierarchy files split by the hierarchy
+// step - are fetched on first access and retained in a least-recently-used
+// cache bounded by their total size in memory.
 class HierarchyReader
 {
 public:
     using Keys = std::map<Dxyz, uint64_t>;
 
-    HierarchyReader(const Metadata& metadata, const arbiter::Endpoint& out)
-        : m_metadata(metadata)
-        , m_ep(out.getSubEndpoint("h"))
-        , m_step(m_metadata.hierarchyStep())
-    {
-        load();
-    }
+    HierarchyReader(
+            const Metadata& metadata,
+            const arbiter::Endpoint& out,
+            std::size_t maxBytes = 256 * 1024 * 1024);
 
-    uint64_t count(const Dxyz& p) const
-    {
-        const auto it(m_keys.find(p));
-        if (it != m_keys.end()) return it->second;
-        else return 0;
-    }
+    uint64_t count(const Dxyz& p) const;
+
+    // Returns null if no statistics were recorded for this node.
+    std::shared_ptr<const ChunkStats> stats(const Dxyz& p) const;
+
+    // Fetch the pages in which these nodes reside, concurrently, if they are
+    // not already cached.  Nodes which do not exist are ignored.  Pages which
+    // fail to load are counted but not cached, so the error is raised again
+    // when they are next accessed.
+    void prefetch(const std::vector<Dxyz>& nodes) const;
+
+    // The root of the page in which this node resides.  Nodes at stepped
+    // depths are duplicated in their parent page, so use the upper one.
+    Dxyz resident(const Dxyz& node) const;
+
+    uint64_t step() const { return m_step; }
+    std::size_t maxBytes() const { return m_maxBytes; }
+
+    // The size of the pages currently cached, and the number of pages which
+    // have failed to load while prefetching.
+    std::size_t bytes() const;
+    uint64_t prefetchErrors() const;
 
 private:
-    // For now, we'll just load everything on init.  This needs to be hooked up
-    // to a caching mechanism.
-    void load(const Dxyz& root = Dxyz())
+    struct PageData
     {
-        const auto json(parse(m_ep.get(root.toString() + ".json")));
-
-        for (const auto s : json.getMemberNames())
-        {
-            const Dxyz key(s);
-            assert(key == root || resident(key) == root);
-            m_keys[key] = json[s].asUInt64();
-
-            if (
-                    m_step &&
-                    key.depth() > root.depth() &&
-                    key.depth() % m_step == 0)
-            {
-                load(key);
-            }
-        }
-    }
-
-    Dxyz resident(const Dxyz& node)
+        std::unique_ptr<HierarchyFile> file;
+        std::map<Dxyz, ChunkStats> stats;
+    };
+
+    using Page = std::shared_ptr<const PageData>;
+
+    struct Entry
     {
-        if (!m_step || node.depth() <= m_step) return Dxyz();
-
-        // Subtract 1 since nodes which are at the stepped depths are duplicated
-        // in their parent resident, so use the upper one.
-        const uint64_t residentDepth((node.depth() - 1) / m_step * m_step);
-        const uint64_t offset(node.depth() - residentDepth);
-        return Dxyz(
-                residentDepth,
-                node.x >> offset,
-                node.y >> offset,
-                node.z >> offset);
-    }
+        std::shared_future<Page> page;
+        std::size_t bytes = 0;
+        std::list<Dxyz>::iterator it;
+    };
+
+    // Returns null if this page does not exist.
+    Page page(const Dxyz& root) const;
+    void purge(const Dxyz& keep) const;
 
     const Metadata& m_metadata;
     const arbiter::Endpoint m_ep;
     const uint64_t m_step;
+    const std::size_t m_maxBytes;
+
+    mutable std::mutex m_mutex;
+    mutable std::map<Dxyz, Entry> m_pages;
+    mutable std::list<Dxyz> m_order;
+    mutable std::size_t m_bytes = 0;
+    mutable uint64_t m_prefetchErrors = 0;
 
-    Keys m_keys;
+    // Declared last, so that any outstanding fetches finish before the rest of
+    // this reader is destroyed.
+    std::unique_ptr<Pool> m_pool;
 };
 
 } // namespace entwine
@@ -52,6 +52,8 @@ public:
         m_filters.push_back(std::move(f));
     }
 
+    bool empty() const { return m_filters.empty(); }
+
 protected:
     std::vector<std::unique_ptr<Filterable>> m_filters;
 };
@@ -79,6 +81,27 @@ public:
         return true;
     }
 
+    virtual bool check(const ChunkStats& stats) const override
+    {
+        for (const auto& f : m_filters)
+        {
+            if (!f->check(stats)) return false;
+        }
+
+        return true;
+    }
+
+    virtual uint64_t check(const FilterBlock& block) const override
+    {
+        uint64_t mask(block.all());
+        for (const auto& f : m_filters)
+        {
+            if (!(mask &= f->check(block))) break;
+        }
+
+        return mask;
+    }
+
     virtual void log(const std::string& pre) const override
     {
         if (m_filters.size()) std::cout << pre << "AND" << std::endl;
@@ -109,6 +132,29 @@ public:
         return false;
     }
 
+    virtual bool check(const ChunkStats& stats) const override
+    {
+        for (const auto& f : m_filters)
+        {
+            if (f->check(stats)) return true;
+        }
+
+        return false;
+    }
+
+    virtual uint64_t check(const FilterBlock& block) const override
+    {
+        const uint64_t all(block.all());
+
+        uint64_t mask(0);
+        for (const auto& f : m_filters)
+        {
+            if ((mask |= f->check(block)) == all) break;
+        }
+
+        return mask;
+    }
+
     virtual void log(const std::string& pre) const override
     {
         std::cout << pre << "OR" << std::endl;
@@ -130,6 +176,18 @@ public:
         return !LogicalOr::check(bounds);
     }
 
+    // Statistics only tell us whether any point may pass each of our
+    // filters, which says nothing about whether all of them may fail.
+    virtual bool check(const ChunkStats& stats) const override
+    {
+        return true;
+    }
+
+    virtual uint64_t check(const FilterBlock& block) const override
+    {
+        return ~LogicalOr::check(block) & block.all();
+    }
+
     virtual void log(const std::string& pre) const override
     {
         std::cout << pre << "NOR" << std::endl;
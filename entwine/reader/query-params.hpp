@@ -16,6 +16,7 @@
 
 #include <json/json.h>
 
+#include <entwine/builder/heuristics.hpp>
 #include <entwine/types/bounds.hpp>
 #include <entwine/types/delta.hpp>
 #include <entwine/types/metadata.hpp>
@@ -86,6 +87,9 @@ public:
                 q["depth"].asUInt64() + 1 : q["depthEnd"].asUInt64(),
             q["filter"])
     {
+        if (q.isMember("threads")) m_threads = q["threads"].asUInt64();
+        if (q.isMember("prefetch")) m_prefetch = q["prefetch"].asUInt64();
+
         if (q.isMember("depth"))
         {
             if (q.isMember("depthBegin") || q.isMember("depthEnd"))
@@ -112,6 +116,8 @@ public:
     std::size_t db() const { return m_depthBegin; }
     std::size_t de() const { return m_depthEnd; }
     const Json::Value& filter() const { return m_filter; }
+    std::size_t threads() const { return m_threads; }
+    std::size_t prefetch() const { return m_prefetch; }
 
     const Bounds* nativeBounds() const { return m_nativeBounds.get(); }
 
@@ -126,7 +132,10 @@ public:
             b = localize(m, *n, m.delta()->inverse());
         }
 
-        return QueryParams(b, d, db(), de(), filter());
+        QueryParams result(b, d, db(), de(), filter());
+        result.m_threads = m_threads;
+        result.m_prefetch = m_prefetch;
+        return result;
     }
 
 private:
@@ -187,6 +196,12 @@ private:
     const Json::Value m_filter;
 
     std::shared_ptr<Bounds> m_nativeBounds;
+
+    // Maximum number of chunks fetched and processed concurrently.
+    std::size_t m_threads = 4;
+
+    // Maximum number of chunks to prefetch ahead of those being processed.
+    std::size_t m_prefetch = heuristics::prefetchChunks;
 };
 
 } // namespace entwine
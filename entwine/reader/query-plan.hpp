@@ -0,0 +1,88 @@
+/******************************************************************************
+* Copyright (c) 2018, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <json/json.h>
+
+#include <entwine/types/key.hpp>
+
+namespace entwine
+{
+
+// The estimated cost of a query, computed from the hierarchy and the current
+// contents of the cache without reading any point data.
+struct QueryPlan
+{
+    struct Chunk
+    {
+        Chunk(const Dxyz& key, uint64_t points, bool resident)
+            : key(key)
+            , points(points)
+            , resident(resident)
+        { }
+
+        Dxyz key;
+        uint64_t points;
+
+        // True if this chunk may be read without fetching it.
+        bool resident;
+    };
+
+    // The chunks the query would read, and their point counts.
+    std::vector<Chunk> chunks;
+
+    // The total number of points in these chunks, an upper bound on the
+    // number of points selected by the query.
+    uint64_t points = 0;
+
+    // The stored size of the chunks which are not resident, which must be
+    // fetched to run the query, and their size once decoded in the native
+    // schema.  Chunks are fetched whole regardless of the query's schema, so
+    // neither shrinks for narrower projections.  If the stored size of a
+    // chunk is unknown, its decoded size is counted instead.
+    uint64_t fetchBytes = 0;
+    uint64_t decodedBytes = 0;
+
+    // The fraction of points within resident chunks.
+    double resident() const
+    {
+        uint64_t n(0);
+        for (const Chunk& c : chunks) if (c.resident) n += c.points;
+        return points ? static_cast<double>(n) / points : 1.0;
+    }
+
+    Json::Value toJson() const
+    {
+        Json::Value json;
+        json["points"] = static_cast<Json::UInt64>(points);
+        json["fetchBytes"] = static_cast<Json::UInt64>(fetchBytes);
+        json["decodedBytes"] = static_cast<Json::UInt64>(decodedBytes);
+        json["resident"] = resident();
+
+        Json::Value& list(json["chunks"] = Json::arrayValue);
+        for (const Chunk& c : chunks)
+        {
+            Json::Value chunk;
+            chunk["key"] = c.key.toString();
+            chunk["points"] = static_cast<Json::UInt64>(c.points);
+            chunk["resident"] = c.resident;
+            list.append(chunk);
+        }
+
+        return json;
+    }
+};
+
+} // namespace entwine
+
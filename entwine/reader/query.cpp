@@ -10,31 +10,100 @@
 
 #include <entwine/reader/query.hpp>
 
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+
+#include <entwine/builder/heuristics.hpp>
 #include <entwine/reader/reader.hpp>
+#include <entwine/util/pool.hpp>
+#include <entwine/util/unique.hpp>
 
 namespace entwine
 {
 
-Query::Query(const Reader& r, const QueryParams& p)
+Query::Query(const Reader& r, const QueryParams& p, const Schema& output)
     : m_reader(r)
     , m_metadata(r.metadata())
     , m_hierarchy(r.hierarchy())
     , m_params(p.finalize(m_metadata))
     , m_filter(m_metadata, m_params)
-    , m_table(m_metadata.schema())
-    , m_pointRef(m_table, 0)
+    , m_projection(project(output))
     , m_overlaps(overlaps())
 { }
 
-HierarchyReader::Keys Query::overlaps() const
+Schema Query::project(const Schema& output) const
+{
+    const Schema& native(m_metadata.schema());
+    const auto& filtered(m_filter.dims());
+
+    // XYZ are always needed to apply the query bounds.
+    auto needed([&](const DimInfo& dim)
+    {
+        return DimInfo::isXyz(dim.id()) ||
+            output.contains(dim.name()) ||
+            filtered.count(dim.id());
+    });
+
+    // Dimensions without a standard id are numbered in order by the point
+    // layout, so any of those preceding one that we need are kept as well, so
+    // that ids match between the native and projected schemas.
+    std::size_t custom(0);
+    for (std::size_t i(0); i < native.dims().size(); ++i)
+    {
+        const DimInfo& dim(native.dims()[i]);
+        if (pdal::Dimension::id(dim.name()) == pdal::Dimension::Id::Unknown &&
+                needed(dim))
+        {
+            custom = i + 1;
+        }
+    }
+
+    DimList dims;
+    for (std::size_t i(0); i < native.dims().size(); ++i)
+    {
+        const DimInfo& dim(native.dims()[i]);
+        const bool standard(
+                pdal::Dimension::id(dim.name()) !=
+                pdal::Dimension::Id::Unknown);
+
+        if (needed(dim) || (!standard && i < custom)) dims.push_back(dim);
+    }
+
+    return Schema(dims);
+}
+
+HierarchyReader::Keys Query::overlaps()
 {
     HierarchyReader::Keys keys;
-    ChunkKey c(m_metadata);
-    overlaps(keys, c);
+
+    // Traverse one level of hierarchy pages at a time, so that all of the
+    // pages needed for the next level may be fetched concurrently.
+    std::vector<ChunkKey> frontier(1, ChunkKey(m_metadata));
+
+    while (!frontier.empty())
+    {
+        std::vector<Dxyz> nodes;
+        for (const ChunkKey& c : frontier)
+        {
+            if (m_filter.check(c.bounds())) nodes.push_back(c.get());
+        }
+        m_hierarchy.prefetch(nodes);
+
+        std::vector<ChunkKey> next;
+        for (const ChunkKey& c : frontier) overlaps(keys, c, next);
+        frontier.swap(next);
+    }
+
     return keys;
 }
 
-void Query::overlaps(HierarchyReader::Keys& keys, const ChunkKey& c) const
+void Query::overlaps(
+        HierarchyReader::Keys& keys,
+        const ChunkKey& c,
+        std::vector<ChunkKey>& next)
 {
     if (!m_filter.check(c.bounds())) return;
 
@@ -42,48 +111,231 @@ void Query::overlaps(HierarchyReader::Keys& keys, const ChunkKey& c) const
     const auto count(m_hierarchy.count(k));
     if (!count) return;
 
-    if (c.depth() >= m_params.db()) keys[k] = count;
+    // Chunks whose statistics rule out the filter are skipped, but their
+    // descendants must still be traversed.
+    if (c.depth() >= m_params.db())
+    {
+        const auto stats(m_hierarchy.stats(k));
+        if (!stats || m_filter.check(*stats)) keys[k] = count;
+
+        // Every point of a chunk lies within its bounds.
+        if (
+                m_filter.empty() &&
+                ChunkReader::overlap(m_params.bounds(), c.bounds()) ==
+                    ChunkReader::Overlap::All)
+        {
+            m_contained.insert(k);
+        }
+    }
 
     if (c.depth() + 1 >= m_params.de()) return;
 
+    // The children of a node at a stepped depth reside in a different page.
+    const uint64_t step(m_hierarchy.step());
+    const bool paged(step && c.depth() && c.depth() % step == 0);
+
     for (std::size_t i(0); i < dirEnd(); ++i)
     {
-        overlaps(keys, c.getStep(toDir(i)));
+        if (paged) next.push_back(c.getStep(toDir(i)));
+        else overlaps(keys, c.getStep(toDir(i)), next);
     }
 }
 
 void Query::run()
 {
+    std::vector<Dxyz> keys;
+
+    // The estimated decoded size of the chunks preceding each one.
+    std::vector<std::size_t> totals(1, 0);
+
     for (const auto& k : m_overlaps)
     {
-        // For now we're doing one at a time.
-        std::vector<Dxyz> keys;
+        if (counting() && m_contained.count(k.first))
+        {
+            m_numPoints += k.second;
+            continue;
+        }
+
         keys.push_back(k.first);
-        auto block(m_reader.cache().acquire(m_reader, keys));
+        totals.push_back(totals.back() + k.second * m_projection.pointSize());
+    }
 
-        for (auto& chunk : block)
+    // Keep the chunks following the merge position loading in the background
+    // so their fetches overlap with processing, up to the prefetch count and
+    // a fraction of the cache.
+    const std::size_t budget(
+            m_reader.cache().maxBytes() * heuristics::prefetchCacheRatio);
+    std::size_t prefetched(0);
+
+    auto prefetch([&](const std::size_t pos)
+    {
+        const std::size_t end(
+                std::min(keys.size(), pos + 1 + m_params.prefetch()));
+
+        std::vector<Dxyz> batch;
+        for (
+                std::size_t i(std::max(prefetched, pos + 1));
+                i < end && totals[i + 1] - totals[pos + 1] <= budget;
+                ++i)
+        {
+            batch.push_back(keys[i]);
+            prefetched = i + 1;
+        }
+
+        m_reader.prefetch(batch, m_projection);
+    });
+
+    const std::size_t threads(
+            std::min<std::size_t>(m_params.threads(), keys.size()));
+
+    if (threads <= 1)
+    {
+        for (std::size_t i(0); i < keys.size(); ++i)
         {
-            for (const auto& cell : chunk->cells())
+            prefetch(i);
+
+            auto local(execute(keys[i]));
+            m_numPoints += local->numPoints;
+            merge(*local);
+        }
+        return;
+    }
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<std::unique_ptr<Local>> results(keys.size());
+    std::vector<std::exception_ptr> errors(keys.size());
+    std::vector<char> done(keys.size(), false);
+
+    // Declared last so it is joined before the state above is destroyed.
+    Pool pool(threads, threads, false);
+    std::size_t added(0);
+
+    for (std::size_t i(0); i < keys.size(); ++i)
+    {
+        // Bound the number of chunks in flight ahead of the merge position.
+        while (added < keys.size() && added < i + threads * 2)
+        {
+            const std::size_t n(added++);
+            pool.add([this, &keys, &mutex, &cv, &results, &errors, &done, n]()
             {
-                maybeProcess(cell);
+                std::unique_ptr<Local> local;
+                std::exception_ptr error;
+
+                try { local = execute(keys[n]); }
+                catch (...) { error = std::current_exception(); }
+
+                std::lock_guard<std::mutex> lock(mutex);
+                results[n] = std::move(local);
+                errors[n] = error;
+                done[n] = true;
+                cv.notify_all();
+            });
+        }
+
+        prefetch(i);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&done, i]() { return done[i]; });
+
+        if (errors[i]) std::rethrow_exception(errors[i]);
+        std::unique_ptr<Local> local(std::move(results[i]));
+        lock.unlock();
+
+        m_numPoints += local->numPoints;
+        merge(*local);
+    }
+}
+
+std::unique_ptr<Query::Local> Query::execute(const Dxyz& key)
+{
+    std::unique_ptr<Local> local(makeUnique<Local>(m_projection));
+
+    std::vector<Dxyz> keys;
+    keys.push_back(key);
+    auto block(m_reader.cache().acquire(m_reader, keys, m_projection));
+
+    const Bounds& bounds(m_params.bounds());
+
+    for (auto& chunk : block)
+    {
+        const auto& cells(chunk->sorted());
+        const auto& blocks(chunk->blocks());
+
+        // Skip blocks outside of the query bounds entirely, and skip the
+        // bounds check for blocks entirely within them.
+        for (std::size_t b(0); b < blocks.size(); ++b)
+        {
+            const auto overlap(ChunkReader::overlap(bounds, blocks[b]));
+            if (overlap == ChunkReader::Overlap::None) continue;
+
+            const bool contained(overlap == ChunkReader::Overlap::All);
+            const std::size_t begin(b * ChunkReader::blockSize);
+            const std::size_t end(
+                    std::min(cells.size(), begin + ChunkReader::blockSize));
+
+            for (std::size_t i(begin); i < end; ++i)
+            {
+                if (contained) push(*local, *cells[i]);
+                else maybeProcess(*local, *cells[i]);
             }
         }
     }
+
+    processBlock(*local);
+
+    return local;
+}
+
+void Query::maybeProcess(Local& local, const Cell& cell)
+{
+    if (m_params.bounds().contains(cell.point())) push(local, cell);
+}
+
+void Query::push(Local& local, const Cell& cell)
+{
+    local.cells[local.block.size()] = &cell;
+    local.block.push(cell.uniqueData());
+
+    if (local.block.full()) processBlock(local);
 }
 
-void Query::maybeProcess(const Cell& cell)
+void Query::processBlock(Local& local)
 {
-    if (!m_params.bounds().contains(cell.point())) return;
-    m_table.setPoint(cell.uniqueData());
-    if (!m_filter.check(m_pointRef)) return;
-    process(cell);
-    ++m_numPoints;
+    FilterBlock& block(local.block);
+    if (block.empty()) return;
+
+    const uint64_t mask(m_filter.check(block));
+
+    for (std::size_t i(0); i < block.size(); ++i)
+    {
+        if (!((mask >> i) & 1)) continue;
+
+        const Cell& cell(*local.cells[i]);
+        local.table.setPoint(cell.uniqueData());
+        process(local, cell);
+        ++local.numPoints;
+    }
+
+    block.clear();
 }
 
-void ReadQuery::process(const Cell& cell)
+ReadQuery::ReadQuery(
+        const Reader& r,
+        const QueryParams& p,
+        const Schema& s)
+    : Query(r, p, s.empty() ? r.metadata().schema() : s)
+    , m_schema(s.empty() ? m_metadata.schema() : s)
+    , m_mid(m_params.nativeBounds() ?
+            m_params.delta().offset() :
+            m_metadata.boundsScaledCubic().mid())
+{ }
+
+void ReadQuery::process(Local& local, const Cell& cell)
 {
-    m_data.resize(m_data.size() + m_schema.pointSize(), 0);
-    char* pos(m_data.data() + m_data.size() - m_schema.pointSize());
+    std::vector<char>& data(local.data);
+    data.resize(data.size() + m_schema.pointSize(), 0);
+    char* pos(data.data() + data.size() - m_schema.pointSize());
 
     std::size_t dimNum(0);
 
@@ -94,16 +346,76 @@ void ReadQuery::process(const Cell& cell)
         if (dimNum < 3 &&
                 (m_params.delta().exists() || m_params.nativeBounds()))
         {
-            setScaled(dimInfo, dimNum, pos);
+            setScaled(local.pointRef, dimInfo, dimNum, pos);
         }
         else
         {
-            m_pointRef.getField(pos, dimInfo.id(), dimInfo.type());
+            local.pointRef.getField(pos, dimInfo.id(), dimInfo.type());
         }
 
         pos += dimInfo.size();
     }
 }
 
+void ReadQuery::run(const Callback& callback, const uint64_t batchPoints)
+{
+    if (!batchPoints) throw std::runtime_error("Invalid batch size");
+
+    m_callback = callback;
+    m_batchBytes = batchPoints * m_schema.pointSize();
+    m_data.clear();
+    m_data.reserve(m_batchBytes);
+
+    try
+    {
+        run();
+    }
+    catch (...)
+    {
+        m_callback = Callback();
+        throw;
+    }
+
+    if (!m_data.empty())
+    {
+        m_callback(m_data.data(), m_data.size() / m_schema.pointSize());
+    }
+
+    m_callback = Callback();
+    m_data.clear();
+}
+
+void ReadQuery::merge(Local& local)
+{
+    if (!m_callback)
+    {
+        m_data.insert(m_data.end(), local.data.begin(), local.data.end());
+        return;
+    }
+
+    const std::size_t pointSize(m_schema.pointSize());
+    auto pos(local.data.cbegin());
+
+    while (pos != local.data.cend())
+    {
+        const std::size_t n(
+                std::min<std::size_t>(
+                    m_batchBytes - m_data.size(),
+                    local.data.cend() - pos));
+
+        m_data.insert(m_data.end(), pos, pos + n);
+        pos += n;
+
+        if (m_data.size() == m_batchBytes)
+        {
+            m_callback(m_data.data(), m_data.size() / pointSize);
+            m_data.clear();
+        }
+    }
+
+    // Release this chunk's results now rather than when the Local is freed.
+    std::vector<char>().swap(local.data);
+}
+
 } // namespace entwine
 
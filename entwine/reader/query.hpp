@@ -10,9 +10,14 @@
 
 #pragma once
 
+#include <array>
+#include <functional>
+#include <set>
+
 #include <entwine/reader/query-params.hpp>
 
 #include <entwine/reader/filter.hpp>
+#include <entwine/reader/filter-block.hpp>
 #include <entwine/reader/hierarchy-reader.hpp>
 #include <entwine/reader/chunk-reader.hpp>
 #include <entwine/types/binary-point-table.hpp>
@@ -27,34 +32,91 @@ class Reader;
 class Query
 {
 public:
-    Query(const Reader& reader, const QueryParams& params);
+    // Only the dimensions of the output schema, along with those needed to
+    // apply the query bounds and filter, are decoded.
+    Query(
+            const Reader& reader,
+            const QueryParams& params,
+            const Schema& output = Schema());
     virtual ~Query() { }
 
+    // Overlapping chunks are fetched and filtered by up to the number of
+    // threads given by the query parameters, and their results are merged in
+    // traversal order, so the output does not depend on this concurrency.
     void run();
 
     uint64_t numPoints() const { return m_numPoints; }
 
+    // The chunks this query visits, in traversal order, and their point
+    // counts.
+    const HierarchyReader::Keys& chunks() const { return m_overlaps; }
+
+    // The schema into which this query decodes its chunks, a subset of the
+    // dimensions of the dataset in their native order.
+    const Schema& projection() const { return m_projection; }
+
 protected:
-    virtual void process(const Cell& cell) { }
+    // The state for processing a single chunk.
+    struct Local
+    {
+        Local(const Schema& schema)
+            : table(schema)
+            , pointRef(table, 0)
+            , block(schema)
+        { }
+
+        BinaryPointTable table;
+        pdal::PointRef pointRef;
+
+        // Points within the query bounds, awaiting the filter.
+        FilterBlock block;
+        std::array<const Cell*, 64> cells;
+
+        std::vector<char> data;
+        uint64_t numPoints = 0;
+    };
+
+    // Process a point which has passed the query bounds and filter.  This may
+    // be called concurrently for different chunks, so any state must be kept
+    // in the Local, whose table is in the projected schema.
+    virtual void process(Local& local, const Cell& cell) { }
+
+    // Called serially in traversal order with the results of each chunk.
+    virtual void merge(Local& local) { }
+
+    // If true, only the number of selected points is needed, so chunks which
+    // are certain to be entirely selected are counted from the hierarchy
+    // rather than read, and are not processed or merged.
+    virtual bool counting() const { return false; }
 
     const Reader& m_reader;
     const Metadata& m_metadata;
     const HierarchyReader& m_hierarchy;
     const QueryParams m_params;
     const Filter m_filter;
-
-    BinaryPointTable m_table;
-    pdal::PointRef m_pointRef;
+    const Schema m_projection;
 
 private:
-    HierarchyReader::Keys overlaps() const;
-    void overlaps(HierarchyReader::Keys& keys, const ChunkKey& c) const;
+    Schema project(const Schema& output) const;
+
+    HierarchyReader::Keys overlaps();
+    void overlaps(
+            HierarchyReader::Keys& keys,
+            const ChunkKey& c,
+            std::vector<ChunkKey>& next);
+
+    std::unique_ptr<Local> execute(const Dxyz& key);
+    void maybeProcess(Local& local, const Cell& cell);
 
-    void maybeProcess(const Cell& cell);
+    // Queue a cell within the query bounds for the filter.
+    void push(Local& local, const Cell& cell);
+    void processBlock(Local& local);
+
+    // Chunks lying entirely within the query bounds, when there is no filter.
+    std::set<Dxyz> m_contained;
 
     HierarchyReader::Keys m_overlaps;
     uint64_t m_numPoints = 0;
-    std::deque<SharedChunkReader> m_chunks;
 };
 
 class CountQuery : public Query
@@ -63,6 +125,9 @@ public:
     CountQuery(const Reader& reader, const QueryParams& params)
         : Query(reader, params)
     { }
+
+protected:
+    virtual bool counting() const override { return true; }
 };
 
 class ReadQuery : public Query
@@ -71,27 +136,38 @@ public:
     ReadQuery(
             const Reader& reader,
             const QueryParams& params,
-            const Schema& schema)
-        : Query(reader, params)
-        , m_schema(schema.empty() ? m_metadata.schema() : schema)
-        , m_mid(m_params.nativeBounds() ?
-                m_params.delta().offset() :
-                m_metadata.boundsScaledCubic().mid())
-    { }
+            const Schema& schema);
+
+    // Receives a batch of numPoints points, in the output schema.  The data
+    // is only valid for the duration of the call.
+    using Callback = std::function<void(const char* data, uint64_t numPoints)>;
+
+    // Buffer all results, which are then available via data().
+    using Query::run;
+
+    // Stream results to the callback in batches of batchPoints points, except
+    // for possibly the last.  Results are not accumulated in data(), so
+    // memory use is bounded regardless of the query size.
+    void run(const Callback& callback, uint64_t batchPoints = 65536);
 
     const std::vector<char>& data() const { return m_data; }
 
 protected:
-    virtual void process(const Cell& cell) override;
+    virtual void process(Local& local, const Cell& cell) override;
+    virtual void merge(Local& local) override;
 
 private:
-    void setScaled(const DimInfo& dim, std::size_t dimNum, char* pos)
+    void setScaled(
+            const pdal::PointRef& pointRef,
+            const DimInfo& dim,
+            std::size_t dimNum,
+            char* pos)
     {
         double d(0);
         if (m_params.nativeBounds())
         {
             d = Point::unscale(
-                    m_pointRef.getFieldAs<double>(dim.id()),
+                    pointRef.getFieldAs<double>(dim.id()),
                     m_metadata.delta()->scale()[dimNum],
                     m_metadata.delta()->offset()[dimNum]);
 
@@ -103,7 +179,7 @@ private:
         else
         {
             d = Point::scale(
-                    m_pointRef.getFieldAs<double>(dim.id()),
+                    pointRef.getFieldAs<double>(dim.id()),
                     m_mid[dimNum],
                     m_params.delta().scale()[dimNum],
                     m_params.delta().offset()[dimNum]);
@@ -147,6 +223,9 @@ private:
     const Point m_mid;
 
     std::vector<char> m_data;
+
+    Callback m_callback;
+    std::size_t m_batchBytes = 0;
 };
 
 } // namespace entwine
@@ -10,6 +10,10 @@
 
 #include <entwine/reader/reader.hpp>
 
+#include <limits>
+
+#include <entwine/builder/heuristics.hpp>
+#include <entwine/io/io.hpp>
 #include <entwine/util/unique.hpp>
 
 namespace entwine
@@ -26,7 +30,12 @@ Reader::Reader(
                 tmp.size() ? tmp : arbiter::fs::getTempPath()))
     , m_metadata(m_ep)
     , m_hierarchy(m_metadata, m_ep)
-    , m_cache(makeUnique<Cache>())
+    , m_cache(cache ? cache : std::make_shared<Cache>())
+    , m_prefetchPool(
+            makeUnique<Pool>(
+                heuristics::prefetchThreads,
+                std::numeric_limits<std::size_t>::max(),
+                false))
 { }
 
 std::unique_ptr<CountQuery> Reader::count(const Json::Value& j) const
@@ -41,5 +50,66 @@ std::unique_ptr<ReadQuery> Reader::read(const Json::Value& j) const
     return makeUnique<ReadQuery>(*this, p, Schema(j["schema"]));
 }
 
+QueryPlan Reader::plan(const Json::Value& j) const
+{
+    // Constructing a query traverses the hierarchy, but reads no chunks.
+    const ReadQuery query(*this, QueryParams(j), Schema(j["schema"]));
+
+    const DataIo& io(m_metadata.dataIo());
+
+    QueryPlan plan;
+    for (const auto& p : query.chunks())
+    {
+        const bool resident(
+                m_cache->resident(*this, p.first, query.projection()));
+
+        plan.chunks.emplace_back(p.first, p.second, resident);
+        plan.points += p.second;
+
+        if (resident) continue;
+
+        const uint64_t decoded(p.second * pointSize());
+        plan.decodedBytes += decoded;
+
+        uint64_t stored(decoded);
+        if (io.compressed())
+        {
+            const std::string f(p.first.toString());
+            if (const auto size = io.storedSize(m_ep, m_tmp, f)) stored = *size;
+        }
+        plan.fetchBytes += stored;
+    }
+
+    return plan;
+}
+
+void Reader::prefetch(const QueryParams& params, const Schema& schema) const
+{
+    const ReadQuery query(*this, params, schema);
+    const Schema& projection(query.projection());
+
+    const std::size_t budget(
+            m_cache->maxBytes() * heuristics::prefetchCacheRatio);
+
+    std::vector<Dxyz> keys;
+    std::size_t bytes(0);
+
+    for (const auto& p : query.chunks())
+    {
+        bytes += p.second * projection.pointSize();
+        if (bytes > budget) break;
+        keys.push_back(p.first);
+    }
+
+    prefetch(keys, projection);
+}
+
+void Reader::prefetch(
+        const std::vector<Dxyz>& keys,
+        const Schema& schema) const
+{
+    if (keys.size()) m_cache->prefetch(*this, keys, schema, *m_prefetchPool);
+}
+
 } // namespace entwine
 
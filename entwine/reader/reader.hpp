@@ -16,6 +16,7 @@
 #include <entwine/reader/cache.hpp>
 #include <entwine/reader/hierarchy-reader.hpp>
 #include <entwine/reader/query.hpp>
+#include <entwine/reader/query-plan.hpp>
 #include <entwine/third/arbiter/arbiter.hpp>
 #include <entwine/types/key.hpp>
 #include <entwine/types/metadata.hpp>
@@ -37,6 +38,27 @@ public:
     std::unique_ptr<CountQuery> count(const Json::Value& json) const;
     std::unique_ptr<ReadQuery> read(const Json::Value& json) const;
 
+    // Estimate the cost of a read query from the hierarchy, without reading
+    // any point data, so that expensive queries may be rejected or split up
+    // before they are run.  For compressed data types, the stored size of
+    // each chunk which is not cached is taken from its pack index if it is
+    // packed, or else requested from the output endpoint.
+    QueryPlan plan(const Json::Value& json) const;
+
+    // Warm the cache with the chunks which a read query with these parameters
+    // and output schema would visit, in traversal order, up to a fraction of
+    // the cache size.  This returns immediately, and the chunks are loaded in
+    // the background.
+    void prefetch(
+            const QueryParams& params,
+            const Schema& schema = Schema()) const;
+
+    // Begin loading these chunks, decoded into the given schema, in the
+    // background.
+    void prefetch(
+            const std::vector<Dxyz>& keys,
+            const Schema& schema) const;
+
     const Metadata& metadata() const { return m_metadata; }
     const HierarchyReader& hierarchy() const { return m_hierarchy; }
     const arbiter::Endpoint& ep() const { return m_ep; }
@@ -54,7 +76,11 @@ private:
     const Metadata m_metadata;
     const HierarchyReader m_hierarchy;
 
-    std::unique_ptr<Cache> m_cache;
+    std::shared_ptr<Cache> m_cache;
+
+    // Declared last, so that any outstanding prefetches finish before the
+    // rest of this reader is destroyed.
+    std::unique_ptr<Pool> m_prefetchPool;
 };
 
 } // namespace entwine
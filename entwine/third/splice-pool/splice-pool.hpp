@@ -22,11 +22,14 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <chrono>
 #include <deque>
 #include <functional>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <thread>
 #include <type_traits>
@@ -769,6 +772,8 @@ public:
     {
         if (node)
         {
+            if (hasExternal() && releaseExternal(node)) return;
+
             reset(&node->val());
 
             // TODO - For these single node releases, we could put them into a
@@ -782,6 +787,17 @@ public:
 
     void release(Stack<T>&& other)
     {
+        if (hasExternal())
+        {
+            // Set aside any nodes which must not be reused.
+            Stack<T> reusable;
+            while (Node<T>* node = other.pop())
+            {
+                if (!releaseExternal(node)) reusable.push(node);
+            }
+            other = std::move(reusable);
+        }
+
         if (Node<T>* node = other.head())
         {
             while (node)
@@ -867,6 +883,26 @@ protected:
         construct(val);
     }
 
+    // For derived pools which allocate outside of doAllocate, so that their
+    // nodes are accounted for once they are released back into this pool.
+    void track(const std::size_t count)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_allocated += count;
+    }
+
+    void untrack(const std::size_t count)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_allocated -= count;
+    }
+
+    // Derived pools may hand out nodes which must not be reused once they are
+    // released.  If so, releaseExternal takes back such a node and returns
+    // true, and is only called while hasExternal is true.
+    virtual bool hasExternal() const { return false; }
+    virtual bool releaseExternal(Node<T>*) { return false; }
+
     virtual Stack<T> doAllocate(std::size_t blocks) = 0;
     virtual void doClear() = 0;
     virtual void construct(T*) const { }
@@ -956,9 +992,91 @@ public:
         , m_bytesPerBlock(m_bufferSize * this->m_blockSize)
         , m_bytes()
         , m_nodes()
+        , m_external()
+        , m_externalNodes(0)
         , m_mutex()
     { }
 
+    // Allocate a dedicated block of exactly _count_ buffers, which are laid
+    // out contiguously in memory.  The resulting stack is ordered by address,
+    // so its head buffer may be treated as the start of a single array of
+    // (count * bufferSize) elements.  Once released, these nodes are returned
+    // to this pool for general reuse like any other.
+    typename SplicePool<T*>::UniqueStackType acquireContiguous(
+            const std::size_t count)
+    {
+        Stack<T*> stack;
+        if (!count) return typename SplicePool<T*>::UniqueStackType(*this);
+
+        std::unique_ptr<std::vector<T>> newBytes(
+                new std::vector<T>(m_bufferSize * count));
+        std::unique_ptr<std::vector<Node<T*>>> newNodes(
+                new std::vector<Node<T*>>(count));
+
+        std::vector<T>& bytes(*newBytes);
+        std::vector<Node<T*>>& nodes(*newNodes);
+
+        for (std::size_t i(count - 1); i < count; --i)
+        {
+            Node<T*>& node(nodes[i]);
+            node.val() = &bytes[m_bufferSize * i];
+            stack.push(&node);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_bytes.push_back(std::move(newBytes));
+            m_nodes.push_back(std::move(newNodes));
+        }
+
+        this->track(count);
+
+        return typename SplicePool<T*>::UniqueStackType(
+                *this,
+                std::move(stack));
+    }
+
+    // Wrap _count_ buffers of externally owned memory beginning at _data_,
+    // which must remain valid for as long as _owner_ is alive.  This memory
+    // is never written by this pool, and these nodes are not reused once
+    // released.  Instead, _owner_ is dropped once all of them are released.
+    typename SplicePool<T*>::UniqueStackType acquireExternal(
+            T* data,
+            const std::size_t count,
+            std::shared_ptr<void> owner)
+    {
+        Stack<T*> stack;
+        if (!count) return typename SplicePool<T*>::UniqueStackType(*this);
+
+        std::unique_ptr<std::vector<Node<T*>>> newNodes(
+                new std::vector<Node<T*>>(count));
+
+        std::vector<Node<T*>>& nodes(*newNodes);
+
+        for (std::size_t i(count - 1); i < count; --i)
+        {
+            Node<T*>& node(nodes[i]);
+            node.val() = data + m_bufferSize * i;
+            stack.push(&node);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            External& external(m_external[data]);
+            external.end = data + m_bufferSize * count;
+            external.nodes = std::move(newNodes);
+            external.owner = std::move(owner);
+            external.outstanding = count;
+            m_externalNodes += count;
+        }
+
+        this->track(count);
+
+        return typename SplicePool<T*>::UniqueStackType(
+                *this,
+                std::move(stack));
+    }
+
 private:
     virtual Stack<T*> doAllocate(std::size_t blocks) override
     {
@@ -1011,6 +1129,32 @@ private:
     {
         m_bytes.clear();
         m_nodes.clear();
+        m_external.clear();
+        m_externalNodes = 0;
+    }
+
+    virtual bool hasExternal() const override { return m_externalNodes != 0; }
+
+    virtual bool releaseExternal(Node<T*>* node) override
+    {
+        T* val(node->val());
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            auto it(m_external.upper_bound(val));
+            if (it == m_external.begin()) return false;
+            --it;
+
+            External& external(it->second);
+            if (val >= external.end) return false;
+
+            --m_externalNodes;
+            if (!--external.outstanding) m_external.erase(it);
+        }
+
+        this->untrack(1);
+        return true;
     }
 
     virtual void construct(T** val) const override
@@ -1023,6 +1167,18 @@ private:
 
     std::deque<std::unique_ptr<std::vector<T>>> m_bytes;
     std::deque<std::unique_ptr<std::vector<Node<T*>>>> m_nodes;
+
+    // Externally owned buffers, by the start of their memory.
+    struct External
+    {
+        T* end = nullptr;
+        std::unique_ptr<std::vector<Node<T*>>> nodes;
+        std::shared_ptr<void> owner;
+        std::size_t outstanding = 0;
+    };
+
+    std::map<T*, External> m_external;
+    std::atomic<std::size_t> m_externalNodes;
     mutable std::mutex m_mutex;
 };
 
@@ -0,0 +1,141 @@
+/******************************************************************************
+* Copyright (c) 2018, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <map>
+
+#include <json/json.h>
+
+#include <pdal/Dimension.hpp>
+
+#include <entwine/types/schema.hpp>
+
+namespace entwine
+{
+
+// The range of the values of a single dimension within a chunk.  If every
+// value is an integer in [0, 64), which is the common case for dimensions like
+// Classification, then the exact set of values present is also tracked.
+class DimStats
+{
+public:
+    DimStats() = default;
+
+    // Values which are not integers in [0, 64) cannot have been written by
+    // add, so if any are present the stats are treated as inexact.
+    explicit DimStats(const Json::Value& json)
+        : m_min(json["min"].asDouble())
+        , m_max(json["max"].asDouble())
+        , m_exact(json["values"].isArray())
+    {
+        for (const Json::Value& v : json["values"])
+        {
+            if (!v.isUInt64() || v.asUInt64() >= 64)
+            {
+                m_exact = false;
+                m_values = 0;
+                return;
+            }
+
+            m_values |= 1ULL << v.asUInt64();
+        }
+    }
+
+    void add(double v)
+    {
+        m_min = std::min(m_min, v);
+        m_max = std::max(m_max, v);
+
+        if (!m_exact) return;
+
+        if (v >= 0 && v < 64 && std::floor(v) == v)
+        {
+            m_values |= 1ULL << static_cast<uint64_t>(v);
+        }
+        else m_exact = false;
+    }
+
+    Json::Value toJson() const
+    {
+        Json::Value json;
+        json["min"] = m_min;
+        json["max"] = m_max;
+
+        if (m_exact)
+        {
+            json["values"] = Json::arrayValue;
+            for (uint64_t i(0); i < 64; ++i)
+            {
+                if (m_values & (1ULL << i))
+                {
+                    json["values"].append(static_cast<Json::UInt64>(i));
+                }
+            }
+        }
+
+        return json;
+    }
+
+    double min() const { return m_min; }
+    double max() const { return m_max; }
+
+    // If true, the bits of values() are exactly the values present.
+    bool exact() const { return m_exact; }
+    uint64_t values() const { return m_values; }
+
+    // Returns false only if no point in this chunk has this value.
+    bool mayContain(double v) const
+    {
+        if (v < m_min || v > m_max) return false;
+        if (!m_exact) return true;
+        return v >= 0 && v < 64 && std::floor(v) == v &&
+            (m_values & (1ULL << static_cast<uint64_t>(v)));
+    }
+
+private:
+    double m_min = std::numeric_limits<double>::max();
+    double m_max = std::numeric_limits<double>::lowest();
+    bool m_exact = true;
+    uint64_t m_values = 0;
+};
+
+using ChunkStats = std::map<pdal::Dimension::Id, DimStats>;
+
+inline Json::Value toJson(const ChunkStats& stats, const Schema& schema)
+{
+    Json::Value json(Json::objectValue);
+    for (const auto& p : stats)
+    {
+        json[schema.find(p.first).name()] = p.second.toJson();
+    }
+    return json;
+}
+
+inline ChunkStats toChunkStats(const Json::Value& json, const Schema& schema)
+{
+    ChunkStats stats;
+    for (const std::string& name : json.getMemberNames())
+    {
+        const auto id(schema.getId(name));
+        if (id != pdal::Dimension::Id::Unknown)
+        {
+            stats[id] = DimStats(json[name]);
+        }
+    }
+    return stats;
+}
+
+} // namespace entwine
+
@@ -11,6 +11,9 @@
 #include <cassert>
 
 #include <entwine/io/io.hpp>
+#include <entwine/io/hierarchy-file.hpp>
+#include <entwine/io/packer.hpp>
+#include <entwine/io/write-queue.hpp>
 #include <entwine/types/delta.hpp>
 #include <entwine/types/files.hpp>
 #include <entwine/types/metadata.hpp>
@@ -40,6 +43,8 @@ Metadata::Metadata(const Config& config, const bool exists)
     , m_schema(makeUnique<Schema>(config.schema()))
     , m_files(makeUnique<Files>(config.input()))
     , m_dataIo(DataIo::create(*this, config.dataType()))
+    , m_packer(makeUnique<Packer>(config.packThreshold(), config.packStep()))
+    , m_writeQueue(makeUnique<WriteQueue>(*m_packer))
     , m_reprojection(Reprojection::create(config["reprojection"]))
     , m_version(makeUnique<Version>(currentVersion()))
     , m_srs(config.srs().empty() && m_reprojection ?
@@ -52,7 +57,21 @@ Metadata::Metadata(const Config& config, const bool exists)
     , m_overflowDepth(std::max(config.overflowDepth(), m_sharedDepth))
     , m_overflowThreshold(config.overflowThreshold())
     , m_hierarchyStep(config.hierarchyStep())
+    , m_hierarchyType(config.hierType())
 {
+    HierarchyFile::check(m_hierarchyType);
+
+    for (const Json::Value& v : config.chunkStats())
+    {
+        const std::string name(v.asString());
+        const auto id(m_schema->getId(name));
+        if (id == pdal::Dimension::Id::Unknown)
+        {
+            throw std::runtime_error("Unknown chunkStats dimension: " + name);
+        }
+        m_chunkStats.push_back(id);
+    }
+
     if (1UL << m_startDepth != m_ticks)
     {
         throw std::runtime_error("Invalid 'ticks' setting");
@@ -91,6 +110,11 @@ Metadata::Metadata(const Config& config, const bool exists)
     {
         throw std::runtime_error("Laszip output needs scaling.");
     }
+
+    if (m_subset && m_packer->threshold())
+    {
+        throw std::runtime_error("Chunk packing is not supported for subsets");
+    }
 }
 
 Metadata::Metadata(const arbiter::Endpoint& ep, const Config& config)
@@ -135,8 +159,13 @@ Json::Value Metadata::toJson() const
     }
 
     json["dataType"] = m_dataIo->type();
-    json["hierarchyType"] = "json"; // TODO.
+    json["hierarchyType"] = m_hierarchyType;
     if (m_hierarchyStep) json["hierarchyStep"] = (Json::UInt64)m_hierarchyStep;
+    if (m_packer->step()) json["packStep"] = (Json::UInt64)m_packer->step();
+    for (const auto id : m_chunkStats)
+    {
+        json["chunkStats"].append(m_schema->find(id).name());
+    }
 
     return json;
 }
@@ -149,6 +178,10 @@ Json::Value Metadata::toBuildParamsJson() const
     json["trustHeaders"] = m_trustHeaders;
     json["overflowDepth"] = (Json::UInt64)m_overflowDepth;
     json["overflowThreshold"] = (Json::UInt64)m_overflowThreshold;
+    if (m_packer->threshold())
+    {
+        json["packThreshold"] = (Json::UInt64)m_packer->threshold();
+    }
     if (m_subset) json["subset"] = m_subset->toJson();
 
     return json;
@@ -31,6 +31,8 @@ namespace arbiter { class Endpoint; }
 class DataIo;
 class Delta;
 class Files;
+class Packer;
+class WriteQueue;
 class Point;
 class Reprojection;
 class Schema;
@@ -90,6 +92,8 @@ public:
     const Files& files() const { return *m_files; }
 
     const DataIo& dataIo() const { return *m_dataIo; }
+    Packer& packer() const { return *m_packer; }
+    WriteQueue& writeQueue() const { return *m_writeQueue; }
 
     const Reprojection* reprojection() const { return m_reprojection.get(); }
     const Subset* subset() const { return m_subset.get(); }
@@ -110,6 +114,13 @@ public:
     uint64_t overflowDepth() const { return m_overflowDepth; }
     uint64_t overflowThreshold() const { return m_overflowThreshold; }
     uint64_t hierarchyStep() const { return m_hierarchyStep; }
+    const std::string& hierarchyType() const { return m_hierarchyType; }
+
+    // Dimensions for which per-chunk statistics are recorded.
+    const std::vector<pdal::Dimension::Id>& chunkStats() const
+    {
+        return m_chunkStats;
+    }
 
     void makeWhole();
 
@@ -141,6 +152,8 @@ private:
     std::unique_ptr<Schema> m_schema;
     std::unique_ptr<Files> m_files;
     std::unique_ptr<DataIo> m_dataIo;
+    std::unique_ptr<Packer> m_packer;
+    std::unique_ptr<WriteQueue> m_writeQueue;
     std::unique_ptr<Reprojection> m_reprojection;
     std::unique_ptr<Transformation> m_transformation;
     std::unique_ptr<Version> m_version;
@@ -157,6 +170,8 @@ private:
     const uint64_t m_overflowThreshold;
 
     uint64_t m_hierarchyStep;
+    const std::string m_hierarchyType;
+    std::vector<pdal::Dimension::Id> m_chunkStats;
 };
 
 } // namespace entwine
@@ -119,15 +119,24 @@ public:
         , m_cellPool(1024 * 1024)
     { }
 
-    PointPool(const Schema& schema, const Delta* delta, std::size_t blockSize)
+    // Points acquired from a read-only pool are never modified, and the pool
+    // is never used to build chunks which may be rewritten, so its points may
+    // be backed directly by the files from which they were read.
+    PointPool(
+            const Schema& schema,
+            const Delta* delta,
+            std::size_t blockSize,
+            bool readOnly = false)
         : m_schema(schema)
         , m_delta(delta)
         , m_dataPool(schema.pointSize(), blockSize)
         , m_cellPool(blockSize)
+        , m_readOnly(readOnly)
     { }
 
     const Schema& schema() const { return m_schema; }
     const Delta* delta() const { return m_delta; }
+    bool readOnly() const { return m_readOnly; }
     Data::Pool& dataPool() { return m_dataPool; }
     Cell::Pool& cellPool() { return m_cellPool; }
 
@@ -149,6 +158,7 @@ private:
 
     Data::Pool m_dataPool;
     Cell::Pool m_cellPool;
+    const bool m_readOnly = false;
 };
 
 } // namespace entwine
@@ -0,0 +1,169 @@
+/******************************************************************************
+* Copyright (c) 2018, Connor Manning (connor@hobu.co)
+*
+* Entwine -- Point cloud indexing
+*
+* Entwine is available under the terms of the LGPL2 license. See COPYING
+* for specific license text and more information.
+*
+******************************************************************************/
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <pdal/PointRef.hpp>
+
+#include <entwine/types/binary-point-table.hpp>
+#include <entwine/types/schema.hpp>
+
+namespace entwine
+{
+
+namespace detail
+{
+
+// An integral sort key, and the index of the item from which it was taken.
+struct SortKey
+{
+    uint64_t key;
+    std::size_t index;
+};
+
+// Map a double onto an unsigned integer whose ordering matches that of the
+// doubles themselves.  Positive and negative zero compare equal, so they are
+// given the same key.
+inline uint64_t orderedBits(double d)
+{
+    if (d == 0) d = 0;
+
+    uint64_t u;
+    std::memcpy(&u, &d, sizeof(double));
+
+    const uint64_t sign(1ULL << 63);
+    return (u & sign) ? ~u : (u | sign);
+}
+
+// Stable LSD radix sort by key, one byte per pass.  Passes for which every
+// key shares the same byte are skipped.
+inline void radixSort(std::vector<SortKey>& keys)
+{
+    std::vector<std::array<std::size_t, 256>> counts(8);
+    for (auto& c : counts) c.fill(0);
+
+    auto byte([](uint64_t key, std::size_t b)
+    {
+        return (key >> (b * 8)) & 0xFF;
+    });
+
+    for (const SortKey& k : keys)
+    {
+        for (std::size_t b(0); b < 8; ++b) ++counts[b][byte(k.key, b)];
+    }
+
+    std::vector<SortKey> swap(keys.size());
+
+    for (std::size_t b(0); b < 8; ++b)
+    {
+        auto& count(counts[b]);
+        if (std::count(count.begin(), count.end(), keys.size())) continue;
+
+        std::size_t total(0);
+        for (std::size_t& c : count)
+        {
+            const std::size_t n(c);
+            c = total;
+            total += n;
+        }
+
+        for (const SortKey& k : keys) swap[count[byte(k.key, b)]++] = k;
+        keys.swap(swap);
+    }
+}
+
+} // namespace detail
+
+// Sort point references by GpsTime, falling back to a byte-wise comparison of
+// the point data to break ties.  Each Ref must have a data() member returning
+// a point in the given schema.
+//
+// Rather than extracting the GpsTime of both points for each comparison, we
+// extract a key once per point and radix sort those keys, so only points with
+// equal times are compared against each other.
+template<typename Ref>
+void sortByTime(std::vector<Ref>& refs, const Schema& schema)
+{
+    using DimId = pdal::Dimension::Id;
+
+    const std::size_t ps(schema.pointSize());
+    auto less([ps](const Ref& a, const Ref& b)
+    {
+        return std::memcmp(a.data(), b.data(), ps) < 0;
+    });
+
+    if (refs.size() < 2) return;
+
+    if (!schema.hasTime())
+    {
+        std::sort(refs.begin(), refs.end(), less);
+        return;
+    }
+
+    std::vector<detail::SortKey> keys(refs.size());
+
+    const auto* dim(schema.pdalLayout().dimDetail(DimId::GpsTime));
+    const bool isDouble(dim->type() == pdal::Dimension::Type::Double);
+    const std::size_t offset(dim->offset());
+
+    BinaryPointTable table(schema);
+    const pdal::PointRef& pr(table.ref());
+    double time(0);
+
+    for (std::size_t i(0); i < refs.size(); ++i)
+    {
+        const char* data(refs[i].data());
+
+        if (isDouble) std::memcpy(&time, data + offset, sizeof(double));
+        else
+        {
+            table.setPoint(data);
+            time = pr.getFieldAs<double>(DimId::GpsTime);
+        }
+
+        keys[i].key = detail::orderedBits(time);
+        keys[i].index = i;
+    }
+
+    detail::radixSort(keys);
+
+    std::vector<Ref> sorted;
+    sorted.reserve(refs.size());
+    for (const detail::SortKey& k : keys) sorted.push_back(refs[k.index]);
+
+    auto begin(sorted.begin());
+    auto run(keys.begin());
+    while (run != keys.end())
+    {
+        const uint64_t key(run->key);
+        const auto next(
+                std::find_if(
+                    run,
+                    keys.end(),
+                    [key](const detail::SortKey& k) { return k.key != key; }));
+
+        const auto n(std::distance(run, next));
+        if (n > 1) std::sort(begin, begin + n, less);
+
+        begin += n;
+        run = next;
+    }
+
+    refs.swap(sorted);
+}
+
+} // namespace entwine
+
@@ -21,6 +21,7 @@
 #include <entwine/types/binary-point-table.hpp>
 #include <entwine/types/files.hpp>
 #include <entwine/types/point-pool.hpp>
+#include <entwine/types/point-sort.hpp>
 #include <entwine/types/schema.hpp>
 
 namespace entwine
@@ -259,25 +260,7 @@ public:
             }
         }
 
-        using DimId = pdal::Dimension::Id;
-        BinaryPointTable ta(m_schema), tb(m_schema);
-        const uint64_t ps(m_schema.pointSize());
-
-        std::sort(
-                m_refs.begin(),
-                m_refs.end(),
-                [&ta, &tb, ps](const Ref& a, const Ref& b)
-                {
-                    ta.setPoint(a.data());
-                    tb.setPoint(b.data());
-
-                    double ga(ta.ref().getFieldAs<double>(DimId::GpsTime));
-                    double gb(tb.ref().getFieldAs<double>(DimId::GpsTime));
-
-                    return
-                        (ga < gb) ||
-                        (ga == gb && std::memcmp(a.data(), b.data(), ps) < 0);
-                });
+        sortByTime(m_refs, m_schema);
     }
 
     ~CellTable() { m_pool.release(acquire()); }
@@ -2,7 +2,22 @@
 #include "config.hpp"
 #include "verify.hpp"
 
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <set>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
 #include <entwine/builder/builder.hpp>
+#include <entwine/builder/hierarchy.hpp>
+#include <entwine/io/packer.hpp>
+#include <entwine/io/write-queue.hpp>
+#include <entwine/reader/reader.hpp>
 
 using namespace entwine;
 using DimId = pdal::Dimension::Id;
@@ -56,3 +71,258 @@ TEST(build, basic)
     EXPECT_EQ(info["hierarchyStep"].asUInt64(), v.hierarchyStep());
 }
 
+
+TEST(build, writeQueue)
+{
+    const std::string path(test::dataPath() + "out/write-queue/");
+    arbiter::fs::mkdirp(path);
+    const arbiter::Endpoint ep(a.getEndpoint(path));
+
+    const std::vector<char> first { 1, 2, 3, 4 };
+    const std::vector<char> second { 5, 6 };
+
+    Packer packer(0, 0);
+    WriteQueue queue(packer);
+
+    // Until started, writes are synchronous.
+    queue.put(ep, ep, "sync", first);
+    EXPECT_EQ(a.getBinary(path + "sync"), first);
+    EXPECT_EQ(queue.stats().uploaded, 1u);
+
+    queue.start(2, 1024);
+
+#ifndef _WIN32
+    // Uploading to a FIFO blocks until it is opened for reading, so this
+    // chunk remains pending until we read it.
+    const std::string fifo(path + "pending");
+    arbiter::fs::remove(fifo);
+    ASSERT_EQ(mkfifo(fifo.c_str(), 0644), 0);
+
+    queue.put(ep, ep, "pending", first);
+    EXPECT_EQ(queue.get(ep, ep, "pending"), first);
+
+    // Rewriting a pending chunk replaces it in memory.
+    queue.put(ep, ep, "pending", second);
+    EXPECT_EQ(queue.get(ep, ep, "pending"), second);
+    EXPECT_EQ(queue.stats().pending, 1u);
+    EXPECT_EQ(queue.stats().pendingBytes, second.size());
+
+    // Depending on whether its upload had started, the first version may or
+    // may not be uploaded, but the last version always is.
+    std::thread reader([&fifo, &second]()
+    {
+        std::vector<char> data;
+        while (data != second)
+        {
+            std::ifstream file(fifo, std::ios::in | std::ios::binary);
+            data.assign(
+                    std::istreambuf_iterator<char>(file),
+                    std::istreambuf_iterator<char>());
+        }
+    });
+
+    queue.await();
+    reader.join();
+
+    EXPECT_EQ(queue.stats().pending, 0u);
+    EXPECT_EQ(queue.stats().pendingBytes, 0u);
+    arbiter::fs::remove(fifo);
+#endif
+
+    // Failures of queued uploads are deferred until the queue is awaited.
+    // Small chunks are written to tmp without retries, so use an invalid tmp
+    // path beneath a file.
+    const arbiter::Endpoint bad(a.getEndpoint(path + "sync/tmp/"));
+    Packer packing(1024, 1);
+    WriteQueue failing(packing);
+    failing.start(1, 1024);
+
+    EXPECT_NO_THROW(failing.put(ep, bad, "0-0-0-0", first));
+    EXPECT_THROW(failing.await(), std::runtime_error);
+    EXPECT_EQ(failing.stats().pending, 0u);
+
+    // The error is only reported once.
+    EXPECT_NO_THROW(failing.await());
+}
+
+TEST(build, hierarchyMap)
+{
+    Hierarchy h;
+    Hierarchy::Map expected;
+
+    auto set([&h, &expected](const Dxyz& key, uint64_t n)
+    {
+        h.set(key, n);
+        expected[key] = n;
+    });
+
+    // Enough nodes to grow every shard several times, including the extreme
+    // coordinates of the deepest packable depth.
+    uint64_t n(1);
+    for (uint64_t d(0); d <= 5; ++d)
+    {
+        const uint64_t span(1ULL << d);
+        for (uint64_t x(0); x < span; ++x)
+        {
+            for (uint64_t y(0); y < span; ++y)
+            {
+                for (uint64_t z(0); z < span; ++z)
+                {
+                    set(Dxyz(d, x, y, z), n++);
+                }
+            }
+        }
+    }
+
+    const uint64_t max21((1ULL << 21) - 1);
+    set(Dxyz(21, max21, max21, max21), 21);
+    set(Dxyz(21, 0, max21, 0), 2121);
+
+    // Deeper nodes can't be packed into 64 bits, so they are stored apart.
+    const uint64_t max22((1ULL << 22) - 1);
+    set(Dxyz(22, max22, max22, max22), 22);
+    set(Dxyz(40, 1ULL << 39, 0, 12345), 40);
+
+    // Overwrites replace existing values wherever they are stored.
+    set(Dxyz(3, 1, 2, 3), 333);
+    set(Dxyz(40, 1ULL << 39, 0, 12345), 4040);
+
+    EXPECT_EQ(h.size(), expected.size());
+    EXPECT_EQ(h.map(), expected);
+    for (const auto& p : expected) EXPECT_EQ(h.get(p.first), p.second);
+
+    EXPECT_EQ(h.get(Dxyz(6, 0, 0, 0)), 0u);
+    EXPECT_EQ(h.get(Dxyz(21, max21, max21, max21 - 1)), 0u);
+    EXPECT_EQ(h.get(Dxyz(22, 0, 0, 0)), 0u);
+    EXPECT_EQ(h.get(Dxyz(63, 1, 1, 1)), 0u);
+}
+
+TEST(build, hierarchyAnalysis)
+{
+    // A tree in which each node has two children, along the main diagonal of
+    // its bounds, down to depth 17.
+    Hierarchy h;
+    std::vector<Dxyz> level { Dxyz() };
+    uint64_t total(1);
+    h.set(Dxyz(), 1);
+
+    for (uint64_t d(1); d <= 17; ++d)
+    {
+        std::vector<Dxyz> next;
+        for (const Dxyz& p : level)
+        {
+            next.emplace_back(d, p.x * 2, p.y * 2, p.z * 2);
+            next.emplace_back(d, p.x * 2 + 1, p.y * 2 + 1, p.z * 2 + 1);
+        }
+
+        for (const Dxyz& k : next) h.set(k, 1);
+        total += next.size();
+        level.swap(next);
+    }
+
+    ASSERT_EQ(total, (1u << 18) - 1);
+
+    const Hierarchy::AnalysisSet analysis(h.analyze());
+    ASSERT_EQ(analysis.size(), 6u);
+
+    std::map<uint64_t, Hierarchy::Analysis> byStep;
+    for (const auto& a : analysis) byStep[a.step] = a;
+
+    // With a step of 9, the root file holds depths 0 through 9, and each node
+    // at depth 9 roots a file holding itself and its descendants.
+    const Hierarchy::Analysis& nine(byStep.at(9));
+    EXPECT_EQ(nine.totalFiles, 513u);
+    EXPECT_EQ(nine.totalNodes, total + 512);
+    EXPECT_EQ(nine.maxNodesPerFile, 1023u);
+
+    const Hierarchy::Analysis& five(byStep.at(5));
+    EXPECT_EQ(five.totalFiles, 33825u);
+    EXPECT_EQ(five.maxNodesPerFile, 63u);
+
+    // Every step fits, and a step of 9 gives the most even file sizes by far.
+    for (const auto& a : analysis) EXPECT_TRUE(a.fits()) << a.step;
+    EXPECT_EQ(analysis.begin()->step, 9u);
+
+    EXPECT_THROW(h.analyze(0, 4), std::runtime_error);
+    EXPECT_THROW(h.analyze(6, 5), std::runtime_error);
+}
+
+TEST(build, hierarchyContinuation)
+{
+    const std::string out(test::dataPath() + "out/continued/");
+
+    Config c;
+    c["input"] = test::dataPath() + "ellipsoid-multi";
+    c["output"] = out;
+    c["force"] = true;
+    c["ticks"] = static_cast<Json::UInt64>(v.ticks());
+    c["hierarchyStep"] = static_cast<Json::UInt64>(v.hierarchyStep());
+
+    // Each input file holds one octant, so the first run fills four of them.
+    {
+        Builder b(c);
+        b.go(4);
+    }
+
+    // Mark each hierarchy file with a trailing newline, which the reader
+    // ignores, and which is absent from any file that is rewritten.
+    auto mark([&out]()
+    {
+        for (const std::string& f : a.resolve(out + "h/*.json"))
+        {
+            a.put(f, a.get(f) + "\n");
+        }
+    });
+
+    auto unmarked([&out]()
+    {
+        std::set<std::string> result;
+        for (const std::string& f : a.resolve(out + "h/*.json"))
+        {
+            if (a.get(f).back() != '\n') result.insert(f);
+        }
+        return result;
+    });
+
+    auto check([&out]()
+    {
+        Reader r(out);
+        auto q(r.read(Json::Value()));
+        q->run();
+        EXPECT_EQ(q->numPoints(), v.numPoints());
+
+        uint64_t np(0);
+        for (const auto& p : q->chunks()) np += p.second;
+        EXPECT_EQ(np, v.numPoints());
+    });
+
+    mark();
+    const std::vector<std::string> before(a.resolve(out + "h/*.json"));
+    ASSERT_GT(before.size(), 1u);
+
+    // Filling the remaining octants modifies the root file, but files rooted
+    // within the octants of the first run are unchanged.
+    c["force"] = false;
+    {
+        Builder b(c);
+        b.go();
+    }
+
+    const std::set<std::string> rewritten(unmarked());
+    EXPECT_TRUE(rewritten.count(out + "h/0-0-0-0.json"));
+
+    std::size_t unchanged(0);
+    for (const std::string& f : before) if (!rewritten.count(f)) ++unchanged;
+    EXPECT_GT(unchanged, 0u);
+    check();
+
+    // With nothing left to insert, nothing is rewritten.
+    mark();
+    {
+        Builder b(c);
+        b.go();
+    }
+
+    EXPECT_TRUE(unmarked().empty());
+    check();
+}
@@ -1,32 +1,96 @@
 #include "gtest/gtest.h"
 
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
 #include "config.hpp"
 #include "verify.hpp"
 
 #include <entwine/builder/builder.hpp>
+#include <entwine/io/hierarchy-file.hpp>
+#include <entwine/io/io.hpp>
+#include <entwine/io/packer.hpp>
 #include <entwine/reader/reader.hpp>
+#include <entwine/types/chunk-stats.hpp>
+#include <entwine/util/json.hpp>
 
 namespace
 {
     const Verify v;
-}
 
-TEST(read, count)
-{
     const std::string out(test::dataPath() + "out/ellipsoid/ellipsoid");
 
+    // Build the ellipsoid dataset to the given output, with any further
+    // configuration merged in, and return that output.  If maxFiles is set,
+    // only that many files are inserted.
+    std::string build(
+            const std::string& output = out,
+            const Json::Value& extra = Json::Value(),
+            const std::size_t maxFiles = 0)
     {
         Config c;
         c["input"] = test::dataPath() + "ellipsoid.laz";
-        c["output"] = out;
+        c["output"] = output;
         c["force"] = true;
         c["hierarchyStep"] = static_cast<Json::UInt64>(v.hierarchyStep());
         c["ticks"] = static_cast<Json::UInt64>(v.ticks());
 
+        for (const std::string& key : extra.getMemberNames())
+        {
+            c[key] = extra[key];
+        }
+
         Builder b(c);
-        b.go();
+        b.go(maxFiles);
+        return output;
     }
 
+    // Every point of a dataset in its native schema, sorted, so that datasets
+    // may be compared regardless of the order in which their points are stored.
+    std::vector<std::string> points(const std::string& path)
+    {
+        Reader r(path);
+        auto q(r.read(Json::Value()));
+        q->run();
+
+        const std::vector<char>& data(q->data());
+        const std::size_t pointSize(r.metadata().schema().pointSize());
+
+        std::vector<std::string> result;
+        for (std::size_t i(0); i < data.size(); i += pointSize)
+        {
+            result.emplace_back(data.data() + i, pointSize);
+        }
+
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+
+    // Build the dataset with the given data type, and check that its points
+    // match those of a binary build with the same configuration.
+    void compareToBinary(
+            const std::string& dataType,
+            const Json::Value& extra = Json::Value())
+    {
+        Json::Value binary(extra);
+        binary["dataType"] = "binary";
+        const auto expected(points(build(out + "-binary", binary)));
+        ASSERT_EQ(expected.size(), v.numPoints());
+
+        Json::Value other(extra);
+        other["dataType"] = dataType;
+        EXPECT_EQ(points(build(out + "-" + dataType, other)), expected);
+    }
+}
+
+TEST(read, count)
+{
+    build();
+
     Reader r(out);
     const Metadata& m(r.metadata());
     EXPECT_EQ(m.ticks(), v.ticks());
@@ -46,22 +110,48 @@ TEST(read, count)
     EXPECT_EQ(np, v.numPoints());
 }
 
-TEST(read, data)
+TEST(read, countHierarchy)
 {
-    const std::string out(test::dataPath() + "out/ellipsoid/ellipsoid");
+    build();
+
+    auto cache(std::make_shared<Cache>());
+    Reader r(out, "", cache);
 
+    // Every chunk lies within unbounded, unfiltered queries, so these are
+    // answered without reading any chunks.
+    auto all(r.count(Json::Value()));
+    all->run();
+    EXPECT_EQ(all->numPoints(), v.numPoints());
+    EXPECT_EQ(cache->stats().misses, 0u);
+
+    // Bounded and filtered counts read at least some chunks, but match the
+    // number of points selected by reads.
+    const Bounds octant(r.metadata().boundsNativeCubic().get(toDir(0)));
+
+    Json::Value bounded;
+    bounded["bounds"] = octant.toJson();
+
+    Json::Value filtered;
+    filtered["filter"]["Z"]["$gte"] = octant.min().z;
+
+    for (const Json::Value& j : { bounded, filtered })
     {
-        Config c;
-        c["input"] = test::dataPath() + "ellipsoid.laz";
-        c["output"] = out;
-        c["force"] = true;
-        c["hierarchyStep"] = static_cast<Json::UInt64>(v.hierarchyStep());
-        c["ticks"] = static_cast<Json::UInt64>(v.ticks());
+        auto count(r.count(j));
+        count->run();
 
-        Builder b(c);
-        b.go();
+        auto read(r.read(j));
+        read->run();
+
+        EXPECT_EQ(count->numPoints(), read->numPoints());
     }
 
+    EXPECT_GT(cache->stats().misses, 0u);
+}
+
+TEST(read, data)
+{
+    build();
+
     Reader r(out);
     const Metadata& m(r.metadata());
     EXPECT_EQ(m.ticks(), v.ticks());
@@ -126,7 +216,1183 @@ TEST(read, data)
     ASSERT_EQ(counts.size(), v.numPoints());
 }
 
+TEST(read, stream)
+{
+    build();
+
+    Reader r(out);
+
+    const Schema schema(DimList {
+        pdal::Dimension::Id::X,
+        pdal::Dimension::Id::Y,
+        pdal::Dimension::Id::Z
+    });
+
+    Json::Value j;
+    j["schema"] = schema.toJson();
+    j["threads"] = 1;
+
+    auto buffered(r.read(j));
+    buffered->run();
+    ASSERT_EQ(buffered->data().size(), v.numPoints() * schema.pointSize());
+
+    // Streamed results, fetched concurrently, must match the serial buffered
+    // results exactly.
+    j["threads"] = 8;
+
+    const uint64_t batchPoints(1000);
+    std::vector<char> streamed;
+    uint64_t batches(0);
+    uint64_t partial(0);
+
+    auto q(r.read(j));
+    q->run([&](const char* data, uint64_t n)
+    {
+        ++batches;
+        if (n != batchPoints) ++partial;
+        streamed.insert(streamed.end(), data, data + n * schema.pointSize());
+    }, batchPoints);
+
+    EXPECT_TRUE(q->data().empty());
+    EXPECT_LE(partial, 1u);
+    EXPECT_EQ(batches, (v.numPoints() + batchPoints - 1) / batchPoints);
+    EXPECT_EQ(streamed, buffered->data());
+}
+
 TEST(read, filter)
 {
+    using DimId = pdal::Dimension::Id;
+
+    Reader r(build());
+    const Metadata& m(r.metadata());
+    const Schema& schema(m.schema());
+    const std::size_t pointSize(schema.pointSize());
+
+    struct Values
+    {
+        double classification;
+        double intensity;
+        double time;
+    };
+
+    // Times include non-integers, values beyond the range of the bitset used
+    // for small integers, and both signs of zero.
+    const std::vector<double> times {
+        0.0, -0.0, 0.5, 2.5, 3, -1, 65535, 65536, 70000.25
+    };
+
+    // Points in our native schema, where the last block is partial.
+    const std::size_t np(FilterBlock::capacity() * 3 + 17);
+    std::vector<char> data(np * pointSize, 0);
+    std::vector<Values> values(np);
+
+    BinaryPointTable table(schema);
+    pdal::PointRef& pr(table.ref());
+
+    for (std::size_t i(0); i < np; ++i)
+    {
+        Values& v(values[i]);
+        v.classification = i % 7;
+        v.intensity = (i * 37) % 300;
+        v.time = times[i % times.size()];
+
+        table.setPoint(data.data() + i * pointSize);
+        pr.setField(DimId::Classification, v.classification);
+        pr.setField(DimId::Intensity, v.intensity);
+        pr.setField(DimId::GpsTime, v.time);
+    }
+
+    auto parse([](const std::string& s)
+    {
+        Json::Value json;
+        Json::Reader reader;
+        if (!reader.parse(s, json)) throw std::runtime_error("Bad: " + s);
+        return json;
+    });
+
+    auto in([](double d, const std::vector<double>& list)
+    {
+        return std::find(list.begin(), list.end(), d) != list.end();
+    });
+
+    using Reference = std::function<bool(const Values&)>;
+    const std::vector<std::pair<std::string, Reference>> cases {
+        { R"({ "Classification": 2 })",
+            [](const Values& v) { return v.classification == 2; } },
+        { R"({ "Classification": { "$ne": 2 } })",
+            [](const Values& v) { return v.classification != 2; } },
+        { R"({ "Intensity": { "$gt": 100 } })",
+            [](const Values& v) { return v.intensity > 100; } },
+        { R"({ "Intensity": { "$gte": 100 } })",
+            [](const Values& v) { return v.intensity >= 100; } },
+        { R"({ "Intensity": { "$lt": 100 } })",
+            [](const Values& v) { return v.intensity < 100; } },
+        { R"({ "Intensity": { "$lte": 100 } })",
+            [](const Values& v) { return v.intensity <= 100; } },
+        { R"({ "Intensity": { "$gt": 10, "$lt": 200 } })",
+            [](const Values& v)
+            {
+                return v.intensity > 10 && v.intensity < 200;
+            } },
+        { R"({ "Classification": { "$in": [1, 3, 5] } })",
+            [&](const Values& v)
+            {
+                return in(v.classification, { 1, 3, 5 });
+            } },
+        { R"({ "Classification": { "$nin": [1, 3, 5] } })",
+            [&](const Values& v)
+            {
+                return !in(v.classification, { 1, 3, 5 });
+            } },
+        { R"({ "GpsTime": { "$in": [0, 2.5, 65536, 70000.25, -1] } })",
+            [&](const Values& v)
+            {
+                return in(v.time, { 0, 2.5, 65536, 70000.25, -1 });
+            } },
+        { R"({ "GpsTime": { "$in": [-0.0] } })",
+            [](const Values& v) { return v.time == 0; } },
+        { R"({ "GpsTime": { "$nin": [0.5, 3, 65535, 65536] } })",
+            [&](const Values& v)
+            {
+                return !in(v.time, { 0.5, 3, 65535, 65536 });
+            } },
+        { R"({ "$or": [
+                { "Classification": 1 },
+                { "Intensity": { "$lt": 50 } } ] })",
+            [](const Values& v)
+            {
+                return v.classification == 1 || v.intensity < 50;
+            } },
+        { R"({ "$nor": [
+                { "Classification": 1 },
+                { "Intensity": { "$lt": 50 } } ] })",
+            [](const Values& v)
+            {
+                return !(v.classification == 1 || v.intensity < 50);
+            } },
+        { R"({ "$and": [
+                { "$or": [
+                    { "Classification": { "$in": [0, 6] } },
+                    { "GpsTime": { "$gte": 65536 } } ] },
+                { "$nor": [ { "Intensity": { "$gt": 250 } } ] } ] })",
+            [&](const Values& v)
+            {
+                return
+                    (in(v.classification, { 0, 6 }) || v.time >= 65536) &&
+                    !(v.intensity > 250);
+            } },
+        // The first filter of each gate decides every point, so evaluation
+        // stops early.
+        { R"({ "$and": [
+                { "Classification": 200 },
+                { "Intensity": { "$gte": 0 } } ] })",
+            [](const Values&) { return false; } },
+        { R"({ "$or": [
+                { "Intensity": { "$gte": 0 } },
+                { "Classification": 200 } ] })",
+            [](const Values&) { return true; } }
+    };
+
+    for (const auto& c : cases)
+    {
+        const Filter filter(m, Bounds::everything(), parse(c.first), nullptr);
+        FilterBlock block(schema);
+
+        for (std::size_t begin(0); begin < np; begin += block.capacity())
+        {
+            const std::size_t end(std::min(np, begin + block.capacity()));
+            for (std::size_t i(begin); i < end; ++i)
+            {
+                block.push(data.data() + i * pointSize);
+            }
+
+            const uint64_t mask(filter.check(block));
+
+            // No bits are set beyond the end of a partial block.
+            EXPECT_EQ(mask & ~block.all(), 0u) << c.first;
+
+            for (std::size_t i(begin); i < end; ++i)
+            {
+                const bool selected((mask >> (i - begin)) & 1);
+                table.setPoint(data.data() + i * pointSize);
+
+                ASSERT_EQ(selected, c.second(values[i]))
+                    << c.first << " at point " << i;
+                ASSERT_EQ(selected, filter.check(pr))
+                    << c.first << " at point " << i;
+            }
+
+            block.clear();
+        }
+    }
+}
+
+TEST(read, filterColumns)
+{
+    using Type = pdal::Dimension::Type;
+
+    const std::vector<Type> types {
+        Type::Signed8, Type::Signed16, Type::Signed32, Type::Signed64,
+        Type::Unsigned8, Type::Unsigned16, Type::Unsigned32, Type::Unsigned64,
+        Type::Float, Type::Double
+    };
+
+    DimList dims;
+    for (const Type t : types)
+    {
+        dims.emplace_back(
+                "Dim" + std::to_string(dims.size()),
+                pdal::Dimension::Id::Unknown,
+                t);
+    }
+
+    const Schema schema(dims);
+    const std::size_t pointSize(schema.pointSize());
+    const std::size_t np(FilterBlock::capacity() + 5);
+
+    std::vector<char> data(np * pointSize, 0);
+    BinaryPointTable table(schema);
+    pdal::PointRef& pr(table.ref());
+
+    for (std::size_t i(0); i < np; ++i)
+    {
+        table.setPoint(data.data() + i * pointSize);
+        for (const DimInfo& dim : schema.dims())
+        {
+            const bool isSigned(pdal::Dimension::base(dim.type()) ==
+                    pdal::Dimension::BaseType::Signed);
+            const bool isFloating(pdal::Dimension::base(dim.type()) ==
+                    pdal::Dimension::BaseType::Floating);
+
+            double d(i % 100);
+            if (isSigned) d = -d;
+            if (isFloating) d = d * 0.25 - 10;
+            pr.setField(dim.id(), d);
+        }
+    }
+
+    FilterBlock block(schema);
+    for (std::size_t begin(0); begin < np; begin += block.capacity())
+    {
+        const std::size_t end(std::min(np, begin + block.capacity()));
+        for (std::size_t i(begin); i < end; ++i)
+        {
+            block.push(data.data() + i * pointSize);
+        }
+
+        for (const DimInfo& dim : schema.dims())
+        {
+            const double* column(block.column(dim.id()));
+            for (std::size_t i(begin); i < end; ++i)
+            {
+                table.setPoint(data.data() + i * pointSize);
+                ASSERT_EQ(column[i - begin], pr.getFieldAs<double>(dim.id()))
+                    << dim.name() << " (" << dim.typeString() << ")";
+            }
+        }
+
+        block.clear();
+    }
+}
+
+TEST(read, chunkStats)
+{
+    Json::Value stats;
+    stats["chunkStats"].append("Z");
+
+    build();
+    const std::string statsOut(build(out + "-stats", stats));
+
+    Reader r(out);
+    Reader s(statsOut);
+    ASSERT_EQ(s.metadata().chunkStats().size(), 1u);
+
+    const Schema schema(DimList {
+        pdal::Dimension::Id::X,
+        pdal::Dimension::Id::Y,
+        pdal::Dimension::Id::Z
+    });
+
+    // Skipping chunks by their statistics must not change the results.
+    Json::Value j;
+    j["schema"] = schema.toJson();
+    j["filter"]["Z"]["$gt"] = 0;
+
+    auto expected(r.read(j));
+    expected->run();
+
+    auto pruned(s.read(j));
+    pruned->run();
+
+    ASSERT_GT(expected->numPoints(), 0u);
+    ASSERT_LT(expected->numPoints(), v.numPoints());
+    EXPECT_EQ(pruned->numPoints(), expected->numPoints());
+    EXPECT_EQ(pruned->data(), expected->data());
+}
+
+TEST(read, cache)
+{
+    build();
+
+    auto cache(std::make_shared<Cache>());
+    Reader r(out, "", cache);
+
+    Json::Value j;
+    j["schema"] = Schema(DimList { pdal::Dimension::Id::X }).toJson();
+
+    auto first(r.read(j));
+    first->run();
+
+    const Cache::Stats cold(cache->stats());
+    EXPECT_EQ(cold.hits, 0u);
+    EXPECT_GT(cold.misses, 0u);
+    EXPECT_GT(cold.bytes, 0u);
+
+    // Everything fits, so a repeated query is served entirely from the cache.
+    auto second(r.read(j));
+    second->run();
+
+    const Cache::Stats warm(cache->stats());
+    EXPECT_EQ(warm.hits, cold.misses);
+    EXPECT_EQ(warm.misses, cold.misses);
+    EXPECT_EQ(warm.evictions, 0u);
+    EXPECT_EQ(second->data(), first->data());
+}
+
+TEST(read, projection)
+{
+    build();
+
+    auto cache(std::make_shared<Cache>());
+    Reader r(out, "", cache);
+
+    const Schema narrowSchema(DimList { pdal::Dimension::Id::Intensity });
+    Json::Value j;
+    j["schema"] = narrowSchema.toJson();
+
+    auto narrow(r.read(j));
+    narrow->run();
+    EXPECT_EQ(narrow->projection(), Schema(DimList {
+        pdal::Dimension::Id::X,
+        pdal::Dimension::Id::Y,
+        pdal::Dimension::Id::Z,
+        pdal::Dimension::Id::Intensity
+    }));
+
+    const Cache::Stats projected(cache->stats());
+
+    // Chunks decoded into a different schema are not shared.
+    auto full(r.read(Json::Value()));
+    full->run();
+    EXPECT_EQ(full->projection(), r.metadata().schema());
+
+    const Cache::Stats stats(cache->stats());
+    EXPECT_EQ(stats.misses, projected.misses * 2);
+    EXPECT_LT(projected.bytes, stats.bytes - projected.bytes);
+
+    const Schema& fullSchema(r.metadata().schema());
+    ASSERT_EQ(narrow->numPoints(), full->numPoints());
+
+    BinaryPointTable narrowTable(narrowSchema);
+    BinaryPointTable fullTable(fullSchema);
+
+    for (uint64_t i(0); i < full->numPoints(); ++i)
+    {
+        narrowTable.setPoint(
+                narrow->data().data() + i * narrowSchema.pointSize());
+        fullTable.setPoint(full->data().data() + i * fullSchema.pointSize());
+
+        ASSERT_EQ(
+                narrowTable.ref().getFieldAs<double>(
+                    pdal::Dimension::Id::Intensity),
+                fullTable.ref().getFieldAs<double>(
+                    pdal::Dimension::Id::Intensity));
+    }
+}
+
+TEST(read, plan)
+{
+    build();
+
+    Reader r(out, "", std::make_shared<Cache>());
+
+    Json::Value j;
+    j["bounds"] = r.metadata().boundsNativeCubic().get(toDir(0)).toJson();
+    j["schema"] = Schema(DimList { pdal::Dimension::Id::X }).toJson();
+
+    const QueryPlan cold(r.plan(j));
+    EXPECT_EQ(r.cache().stats().misses, 0u);
+    EXPECT_EQ(cold.resident(), 0.0);
+    EXPECT_EQ(cold.decodedBytes, cold.points * r.pointSize());
+
+    // The default data type is compressed, so less is fetched than decoded.
+    ASSERT_TRUE(r.metadata().dataIo().compressed());
+    EXPECT_GT(cold.fetchBytes, 0u);
+    EXPECT_LT(cold.fetchBytes, cold.decodedBytes);
+
+    // Read only the shallowest chunks of the planned query.
+    Json::Value shallow(j);
+    shallow["depthEnd"] = 2;
+
+    auto partial(r.read(shallow));
+    partial->run();
+
+    const HierarchyReader::Keys& read(partial->chunks());
+    ASSERT_GT(read.size(), 0u);
+    ASSERT_LT(read.size(), cold.chunks.size());
+
+    // Only the chunks which were read are now resident, and only the rest
+    // remain to be fetched.
+    const QueryPlan warm(r.plan(j));
+    ASSERT_EQ(warm.chunks.size(), cold.chunks.size());
+    EXPECT_EQ(warm.points, cold.points);
+
+    const DataIo& io(r.metadata().dataIo());
+    uint64_t remaining(0);
+    uint64_t stored(0);
+    for (const QueryPlan::Chunk& c : warm.chunks)
+    {
+        EXPECT_EQ(c.resident, read.count(c.key) == 1) << c.key;
+        if (c.resident) continue;
+
+        remaining += c.points;
+        stored += io.fetch(r.ep(), r.tmp(), c.key.toString()).size();
+    }
+
+    EXPECT_GT(warm.resident(), 0.0);
+    EXPECT_LT(warm.resident(), 1.0);
+    EXPECT_LT(warm.fetchBytes, cold.fetchBytes);
+    EXPECT_EQ(warm.fetchBytes, stored);
+    EXPECT_EQ(warm.decodedBytes, remaining * r.pointSize());
+
+    // Once the whole query has been read, its chunks match the plan and
+    // nothing remains to be fetched.
+    auto q(r.read(j));
+    q->run();
+
+    ASSERT_EQ(cold.chunks.size(), q->chunks().size());
+    for (const QueryPlan::Chunk& c : cold.chunks)
+    {
+        EXPECT_EQ(c.points, q->chunks().at(c.key));
+    }
+
+    EXPECT_GE(cold.points, q->numPoints());
+
+    const QueryPlan hot(r.plan(j));
+    EXPECT_EQ(hot.points, cold.points);
+    EXPECT_EQ(hot.resident(), 1.0);
+    EXPECT_EQ(hot.fetchBytes, 0u);
+    EXPECT_EQ(hot.decodedBytes, 0u);
+}
+
+TEST(read, columnar)
+{
+    compareToBinary("columnar");
+}
+
+TEST(read, laszip)
+{
+    // With multiple inputs, the OriginId values stored in the extra bytes of
+    // each point vary.
+    Json::Value multi;
+    multi["input"] = test::dataPath() + "ellipsoid-multi";
+    compareToBinary("laszip", multi);
+
+    Reader r(out + "-laszip");
+    ASSERT_TRUE(r.metadata().schema().contains(pdal::Dimension::Id::OriginId));
+
+    const Schema schema(DimList { pdal::Dimension::Id::OriginId });
+    Json::Value j;
+    j["schema"] = schema.toJson();
+
+    auto q(r.read(j));
+    q->run();
+
+    BinaryPointTable table(schema);
+    std::set<uint64_t> origins;
+    for (uint64_t i(0); i < q->numPoints(); ++i)
+    {
+        table.setPoint(q->data().data() + i * schema.pointSize());
+        const pdal::PointRef& pr(table.ref());
+        origins.insert(pr.getFieldAs<uint64_t>(pdal::Dimension::Id::OriginId));
+    }
+
+    EXPECT_EQ(origins.size(), 8u);
+}
+
+#ifdef ENTWINE_ZSTD
+TEST(read, zstandard)
+{
+    compareToBinary("zstandard");
+}
+#endif
+
+TEST(read, columnarCodecs)
+{
+    Reader r(build());
+    const Metadata& m(r.metadata());
+    const Schema& schema(m.schema());
+    const std::size_t pointSize(schema.pointSize());
+
+    using DimId = pdal::Dimension::Id;
+
+    // Each of these dimensions is filled so that a different codec produces
+    // its smallest encoding.
+    std::map<std::string, uint8_t> expected {
+        { "Classification", 2 },    // Constant: Rle.
+        { "X", 1 },                 // Small, irregular steps: Delta.
+        { "UserData", 0 },          // Noise: Raw.
+        { "GpsTime", 4 }            // Sorted doubles: OrderedDelta.
+    };
+#ifdef ENTWINE_ZSTD
+    expected["Intensity"] = 3;      // A short repeating cycle: Zstd.
+#endif
+
+    const uint64_t np(4096);
+    const std::vector<double> cycle { 9001, 17, 60000, 4242, 3, 31337, 777 };
+    uint32_t seed(42);
+    auto random([&seed]()
+    {
+        seed = seed * 1664525 + 1013904223;
+        return seed >> 24;
+    });
+
+    PointPool pool(schema);
+    Cell::PooledStack cells(pool.cellPool().acquire(np));
+    Data::PooledStack data(pool.dataPool().acquire(np));
+    BinaryPointTable table(schema);
+    pdal::PointRef& pr(table.ref());
+
+    std::vector<std::string> records;
+    uint64_t i(0);
+    for (Cell& cell : cells)
+    {
+        Data::PooledNode node(data.popOne());
+        std::fill(*node, *node + pointSize, 0);
+        table.setPoint(*node);
+
+        pr.setField(DimId::X, i * 3 + random() % 2);
+        pr.setField(DimId::Y, i);
+        pr.setField(DimId::Classification, 2);
+        pr.setField(DimId::UserData, random());
+        pr.setField(DimId::Intensity, cycle[i % cycle.size()]);
+        pr.setField(DimId::GpsTime, 1e9 + i * 1e-5 + random() * 1e-8);
+
+        records.emplace_back(*node, pointSize);
+        cell.set(pr, std::move(node));
+        ++i;
+    }
+
+    const std::string path(test::dataPath() + "out/columnar-codecs/");
+    arbiter::fs::mkdirp(path);
+
+    const arbiter::Arbiter a;
+    const arbiter::Endpoint ep(a.getEndpoint(path));
+
+    auto io(DataIo::create(m, "columnar"));
+    io->write(ep, ep, pool, "codecs", std::move(cells), np);
+
+    // Check the codec of each column from the directory.
+    const std::vector<char> file(io->fetch(ep, ep, "codecs"));
+    const char* pos(file.data() + 4 + sizeof(uint64_t));
+    uint32_t numColumns(0);
+    std::copy(
+            pos,
+            pos + sizeof(uint32_t),
+            reinterpret_cast<char*>(&numColumns));
+    pos += sizeof(uint32_t);
+    ASSERT_EQ(numColumns, schema.dims().size());
+
+    std::map<std::string, uint8_t> codecs;
+    for (uint32_t c(0); c < numColumns; ++c)
+    {
+        const uint8_t length(*pos++);
+        const std::string name(pos, length);
+        pos += length;
+        codecs[name] = *pos++;
+        pos += 2 * sizeof(uint64_t);
+    }
+
+    for (const auto& p : expected)
+    {
+        EXPECT_EQ(codecs.at(p.first), p.second) << p.first;
+    }
+
+    Cell::PooledStack decoded(io->read(ep, ep, pool, "codecs"));
+    std::vector<std::string> result;
+    for (const Cell& cell : decoded)
+    {
+        for (const char* d : cell) result.emplace_back(d, pointSize);
+    }
+    pool.release(std::move(decoded));
+
+    std::sort(records.begin(), records.end());
+    std::sort(result.begin(), result.end());
+    EXPECT_EQ(result, records);
+
+    // A point count which doesn't match the stored columns is rejected.
+    std::vector<char> corrupt(file);
+    const uint64_t wrong(np + 1);
+    std::copy(
+            reinterpret_cast<const char*>(&wrong),
+            reinterpret_cast<const char*>(&wrong) + sizeof(uint64_t),
+            corrupt.data() + 4);
+    EXPECT_THROW(io->decode(pool, "codecs", corrupt), std::runtime_error);
+}
+
+TEST(read, packed)
+{
+    Json::Value j;
+    j["input"] = test::dataPath() + "ellipsoid-multi";
+    j["dataType"] = "binary";
+
+    const auto expected(points(build(out + "-binary", j)));
+    ASSERT_EQ(expected.size(), v.numPoints());
+
+    // Pack every chunk, into packs rooted at every other depth.
+    j["packThreshold"] = 1 << 30;
+    j["packStep"] = 2;
+
+    // Build half of the files, and then continue with the rest, so that the
+    // chunks packed by the first run are regrouped with those of the second.
+    const std::string path(out + "-packed");
+    build(path, j, 4);
+
+    j["force"] = false;
+    build(path, j);
+
+    const arbiter::Arbiter a;
+    for (const std::string& f : a.resolve(path + "/*"))
+    {
+        EXPECT_EQ(f.find(".bin"), std::string::npos) << f;
+    }
+
+    // Every chunk lies within exactly one pack.
+    const std::vector<std::string> indexes(a.resolve(path + "/p/*.json"));
+    EXPECT_GT(indexes.size(), 1u);
+
+    std::set<std::string> packed;
+    for (const std::string& index : indexes)
+    {
+        const Json::Value json(parse(a.get(index)));
+        const std::string pack(index.substr(0, index.size() - 5) + ".pack");
+        const uint64_t size(a.getSize(pack));
+
+        for (const std::string& name : json.getMemberNames())
+        {
+            EXPECT_TRUE(packed.insert(name).second) << name;
+            EXPECT_LE(
+                    json[name][0].asUInt64() + json[name][1].asUInt64(),
+                    size) << name;
+        }
+    }
+
+    Reader r(path);
+    auto all(r.read(Json::Value()));
+    all->run();
+    EXPECT_EQ(packed.size(), all->chunks().size());
+
+    // Packed chunks are read by range, and must match the unpacked build.
+    EXPECT_EQ(points(path), expected);
+
+    // With room for only one pack index at a time, indexes are evicted and
+    // fetched again as needed, and reads are unaffected.
+    const arbiter::Endpoint ep(a.getEndpoint(path));
+    Packer unbounded(0, 2);
+    Packer bounded(0, 2, 1);
+
+    for (const auto& p : all->chunks())
+    {
+        const std::string f(p.first.toString() + ".bin");
+        EXPECT_EQ(bounded.get(ep, ep, f), unbounded.get(ep, ep, f)) << f;
+    }
+
+    EXPECT_GT(bounded.indexBytes(), 0u);
+    EXPECT_LT(bounded.indexBytes(), unbounded.indexBytes());
+}
+
+TEST(read, hierarchyFile)
+{
+    const std::string path(test::dataPath() + "out/hierarchy-file/");
+    arbiter::fs::mkdirp(path);
+
+    const arbiter::Arbiter a;
+    const arbiter::Endpoint ep(a.getEndpoint(path));
+
+    // Unsorted, with coordinates beyond 32 bits and keys sharing prefixes.
+    const std::vector<HierarchyFile::Record> records {
+        { Dxyz(3, 5, 1, 7), 30 },
+        { Dxyz(0, 0, 0, 0), 1 },
+        { Dxyz(40, 1ULL << 39, 3, 1ULL << 35), 4000 },
+        { Dxyz(3, 5, 1, 2), 31 },
+        { Dxyz(3, 1, 6, 6), 32 },
+        { Dxyz(1, 1, 0, 1), 10 }
+    };
+
+    const std::vector<Dxyz> absent {
+        Dxyz(0, 0, 0, 1),
+        Dxyz(1, 0, 0, 0),
+        Dxyz(3, 5, 1, 3),
+        Dxyz(3, 5, 1, 8),
+        Dxyz(3, 0, 0, 0),
+        Dxyz(40, 1ULL << 39, 3, (1ULL << 35) + 1),
+        Dxyz(41, 0, 0, 0)
+    };
+
+    for (const std::string type : { "json", "binary" })
+    {
+        std::vector<HierarchyFile::Record> copy(records);
+        const auto data(HierarchyFile::serialize(type, copy));
+        ep.put("h" + HierarchyFile::extension(type), data);
+
+        const auto file(HierarchyFile::load(type, ep, "h"));
+        ASSERT_EQ(file->size(), records.size()) << type;
+
+        for (std::size_t i(1); i < file->size(); ++i)
+        {
+            EXPECT_LT(file->key(i - 1), file->key(i)) << type;
+        }
+
+        for (const HierarchyFile::Record& r : records)
+        {
+            const Dxyz key(r.d, r.x, r.y, r.z);
+            EXPECT_EQ(file->count(key), r.n) << type << " " << key;
+        }
+
+        for (const Dxyz& key : absent)
+        {
+            EXPECT_EQ(file->count(key), 0u) << type << " " << key;
+        }
+    }
+
+    // A truncated binary file is rejected.
+    std::vector<HierarchyFile::Record> copy(records);
+    auto data(HierarchyFile::serialize("binary", copy));
+    data.pop_back();
+    ep.put("h.bin", data);
+    EXPECT_THROW(HierarchyFile::load("binary", ep, "h"), std::runtime_error);
+}
+
+TEST(read, binaryHierarchy)
+{
+    Json::Value j;
+    j["hierarchyType"] = "binary";
+
+    const std::string path(build(out + "-binary-hierarchy", j));
+
+    const arbiter::Arbiter a;
+    const Json::Value info(parse(a.get(path + "/entwine.json")));
+    EXPECT_EQ(info["hierarchyType"].asString(), "binary");
+    EXPECT_FALSE(a.resolve(path + "/h/*.bin").empty());
+    EXPECT_TRUE(a.resolve(path + "/h/*.json").empty());
+
+    Reader expected(build());
+    Reader r(path);
+
+    auto all(expected.read(Json::Value()));
+    all->run();
+
+    // Every node found in the JSON hierarchy has the same count, and their
+    // children which are not found are absent from both.
+    const HierarchyReader::Keys& keys(all->chunks());
+    for (const auto& p : keys)
+    {
+        const Dxyz& key(p.first);
+        EXPECT_EQ(r.hierarchy().count(key), p.second) << key;
+
+        for (uint64_t i(0); i < 8; ++i)
+        {
+            const Dxyz child(
+                    key.d + 1,
+                    key.x * 2 + (i & 1),
+                    key.y * 2 + ((i >> 1) & 1),
+                    key.z * 2 + ((i >> 2) & 1));
+
+            if (keys.count(child)) continue;
+            EXPECT_EQ(r.hierarchy().count(child), 0u) << child;
+            EXPECT_EQ(expected.hierarchy().count(child), 0u) << child;
+        }
+    }
+
+    auto q(r.read(Json::Value()));
+    q->run();
+    EXPECT_EQ(q->chunks(), all->chunks());
+    EXPECT_EQ(q->numPoints(), v.numPoints());
+    EXPECT_EQ(points(path), points(out));
+}
+
+TEST(read, blockOverlap)
+{
+    using Overlap = ChunkReader::Overlap;
+
+    // A block of points which is flat in Z.
+    std::vector<Point> points;
+    Bounds extents(Bounds::expander());
+    for (const double x : { 2.0, 3.0, 5.0 })
+    {
+        for (const double y : { 1.0, 4.0 })
+        {
+            points.emplace_back(x, y, 7);
+            extents.grow(points.back());
+        }
+    }
+
+    struct Case
+    {
+        Bounds query;
+        Overlap expected;
+    };
+
+    const std::vector<Case> cases {
+        { Bounds(0, 0, 0, 10, 10, 10), Overlap::All },
+        { Bounds(2, 1, 7, 6, 5, 8), Overlap::All },
+
+        // Query bounds are half-open, so a block touching their maximum is
+        // outside of them, and one touching their minimum is not.
+        { Bounds(0, 0, 0, 2, 10, 10), Overlap::None },
+        { Bounds(0, 0, 0, 10, 1, 10), Overlap::None },
+        { Bounds(0, 0, 0, 10, 10, 7), Overlap::None },
+        { Bounds(5, 0, 0, 10, 10, 10), Overlap::Partial },
+        { Bounds(0, 4, 0, 10, 10, 10), Overlap::Partial },
+        { Bounds(0, 0, 7, 10, 10, 10), Overlap::All },
+        { Bounds(0, 0, 0, 5, 10, 10), Overlap::Partial },
+        { Bounds(0, 0, 0, 10, 4, 10), Overlap::Partial },
+
+        // The flat dimension is entirely on one side or the other.
+        { Bounds(0, 0, 6, 10, 10, 6.5), Overlap::None },
+        { Bounds(0, 0, 7.5, 10, 10, 8), Overlap::None },
+        { Bounds(3, 0, 6, 4, 10, 8), Overlap::Partial },
+
+        // Two-dimensional queries ignore Z.
+        { Bounds(0, 0, 10, 10), Overlap::All },
+        { Bounds(5, 0, 10, 10), Overlap::Partial },
+        { Bounds(0, 0, 2, 10), Overlap::None }
+    };
+
+    for (const Case& c : cases)
+    {
+        const Overlap overlap(ChunkReader::overlap(c.query, extents));
+        EXPECT_EQ(overlap, c.expected) << c.query;
+
+        // Skipped or accepted blocks agree with the per-point checks.
+        std::size_t n(0);
+        for (const Point& p : points) if (c.query.contains(p)) ++n;
+
+        if (overlap == Overlap::None) EXPECT_EQ(n, 0u) << c.query;
+        if (overlap == Overlap::All) EXPECT_EQ(n, points.size()) << c.query;
+    }
+
+    // In a real chunk, every block bounds its points.
+    build();
+    Reader r(out);
+    const ChunkReader chunk(r, Dxyz(), r.metadata().schema());
+    const auto& sorted(chunk.sorted());
+    const auto& blocks(chunk.blocks());
+
+    ASSERT_EQ(sorted.size(), chunk.cells().size());
+    ASSERT_EQ(
+            blocks.size(),
+            (sorted.size() + ChunkReader::blockSize - 1) /
+                ChunkReader::blockSize);
+
+    for (std::size_t i(0); i < sorted.size(); ++i)
+    {
+        const Bounds& b(blocks.at(i / ChunkReader::blockSize));
+        const Point& p(sorted[i]->point());
+        EXPECT_TRUE(b.min() <= p && p <= b.max()) << i;
+        EXPECT_EQ(
+                ChunkReader::overlap(b, Bounds(p, p)),
+                b.contains(p) ? Overlap::All : Overlap::None);
+    }
+}
+
+TEST(read, threads)
+{
+    build();
+    Reader r(out);
+
+    Json::Value bounded;
+    bounded["bounds"] = r.metadata().boundsNativeCubic().get(toDir(3)).toJson();
+
+    Json::Value filtered;
+    filtered["filter"]["Intensity"]["$gt"] = 100;
+
+    // Parallel reads must merge their chunks in the same order as serial
+    // reads, so their results are identical.
+    for (Json::Value j : { Json::Value(), bounded, filtered })
+    {
+        j["threads"] = 1;
+        auto serial(r.read(j));
+        serial->run();
+        ASSERT_GT(serial->numPoints(), 0u);
+
+        j["threads"] = 8;
+        auto parallel(r.read(j));
+        parallel->run();
+
+        EXPECT_EQ(parallel->numPoints(), serial->numPoints());
+        EXPECT_EQ(parallel->data(), serial->data());
+    }
+}
+
+TEST(read, threadsFailure)
+{
+    Json::Value j;
+    j["dataType"] = "binary";
+    const std::string path(build(out + "-corrupt", j));
+
+    std::vector<Dxyz> keys;
+    {
+        Reader r(path);
+        auto q(r.read(Json::Value()));
+        q->run();
+        for (const auto& p : q->chunks()) keys.push_back(p.first);
+    }
+
+    ASSERT_GT(keys.size(), 2u);
+
+    // Corrupt a chunk in the middle of the merge order and the last one, which
+    // a parallel query may well fail to read first.
+    const Dxyz first(keys[keys.size() / 2]);
+    const Dxyz last(keys.back());
+
+    const arbiter::Arbiter a;
+    for (const Dxyz& key : { first, last })
+    {
+        const std::string f(path + "/" + key.toString() + ".bin");
+        a.put(f, a.get(f) + "x");
+    }
+
+    for (const uint64_t threads : { 1, 8 })
+    {
+        Reader r(path, "", std::make_shared<Cache>());
+        Json::Value q;
+        q["threads"] = static_cast<Json::UInt64>(threads);
+
+        std::string error;
+        try { r.read(q)->run(); }
+        catch (std::exception& e) { error = e.what(); }
+
+        EXPECT_NE(error.find(": " + first.toString()), std::string::npos)
+            << threads << " threads: " << error;
+        EXPECT_EQ(error.find(": " + last.toString()), std::string::npos)
+            << threads << " threads: " << error;
+    }
 }
 
+TEST(read, hierarchyPages)
+{
+    const std::string path(build(out + "-pages"));
+    Reader r(path);
+
+    const arbiter::Arbiter a;
+    const arbiter::Endpoint ep(a.getEndpoint(path));
+    const Metadata& m(r.metadata());
+
+    const HierarchyReader::Keys keys(r.read(Json::Value())->chunks());
+    std::vector<Dxyz> nodes;
+    std::set<Dxyz> pages;
+    for (const auto& p : keys)
+    {
+        nodes.push_back(p.first);
+        pages.insert(r.hierarchy().resident(p.first));
+    }
+    ASSERT_GT(pages.size(), 2u);
+
+    // Nothing is fetched until it is needed, and then only the page in which
+    // the requested node resides.
+    HierarchyReader lazy(m, ep);
+    EXPECT_EQ(lazy.bytes(), 0u);
+    EXPECT_EQ(lazy.count(Dxyz()), keys.at(Dxyz()));
+    const std::size_t root(lazy.bytes());
+    EXPECT_GT(root, 0u);
+
+    for (const auto& p : keys)
+    {
+        if (lazy.resident(p.first) != Dxyz()) continue;
+        EXPECT_EQ(lazy.count(p.first), p.second);
+    }
+    EXPECT_EQ(lazy.bytes(), root);
+
+    // Prefetching fetches every page up front, after which counting fetches
+    // nothing further.
+    HierarchyReader prefetched(m, ep);
+    prefetched.prefetch(nodes);
+    EXPECT_EQ(prefetched.prefetchErrors(), 0u);
+    const std::size_t all(prefetched.bytes());
+    EXPECT_GT(all, root);
+
+    for (const auto& p : keys) EXPECT_EQ(prefetched.count(p.first), p.second);
+    EXPECT_EQ(prefetched.bytes(), all);
+
+    // A small cache evicts pages, which are fetched again when needed.
+    HierarchyReader small(m, ep, 1);
+    for (const auto& p : keys) EXPECT_EQ(small.count(p.first), p.second);
+    EXPECT_LT(small.bytes(), all);
+
+    // A page which fails to load while prefetching is counted, and its error
+    // is raised when it is accessed.  Keys are ordered by depth first, so this
+    // is the deepest page, on which no other page depends.
+    const Dxyz corrupt(*pages.rbegin());
+    ASSERT_NE(corrupt, Dxyz());
+    ep.put(
+            "h/" + corrupt.toString() +
+                HierarchyFile::extension(m.hierarchyType()),
+            std::string("{"));
+
+    std::vector<Dxyz> affected;
+    for (const Dxyz& node : nodes)
+    {
+        if (r.hierarchy().resident(node) == corrupt) affected.push_back(node);
+    }
+    ASSERT_FALSE(affected.empty());
+
+    HierarchyReader failing(m, ep);
+    EXPECT_NO_THROW(failing.prefetch(nodes));
+    EXPECT_EQ(failing.prefetchErrors(), 1u);
+    EXPECT_ANY_THROW(failing.count(affected.front()));
+
+    for (const auto& p : keys)
+    {
+        if (failing.resident(p.first) == corrupt) continue;
+        EXPECT_EQ(failing.count(p.first), p.second);
+    }
+}
+
+TEST(read, prefetch)
+{
+    build();
+
+    Json::Value j;
+    j["schema"] = Schema(DimList { pdal::Dimension::Id::Z }).toJson();
+
+    std::vector<Dxyz> keys;
+    Schema projection;
+    std::vector<char> expected;
+    std::size_t bytes(0);
+
+    {
+        auto cache(std::make_shared<Cache>());
+        Reader r(out, "", cache);
+        auto q(r.read(j));
+        q->run();
+
+        for (const auto& p : q->chunks()) keys.push_back(p.first);
+        projection = q->projection();
+        expected = q->data();
+        bytes = cache->stats().bytes;
+    }
+
+    ASSERT_GT(keys.size(), 2u);
+
+    // With room for every chunk, all of them are retained, so a query which
+    // follows reads nothing further.  Destroying the reader waits for its
+    // prefetches to finish.
+    {
+        auto cache(std::make_shared<Cache>(bytes * 2));
+        Reader(out, "", cache).prefetch(keys, projection);
+
+        const Cache::Stats prefetched(cache->stats());
+        EXPECT_EQ(prefetched.prefetches, keys.size());
+        EXPECT_EQ(prefetched.misses, 0u);
+        EXPECT_EQ(prefetched.rejections, 0u);
+        EXPECT_EQ(prefetched.bytes, bytes);
+
+        Reader r(out, "", cache);
+        auto q(r.read(j));
+        q->run();
+        EXPECT_EQ(q->data(), expected);
+        EXPECT_EQ(cache->stats().misses, 0u);
+        EXPECT_EQ(cache->stats().hits, keys.size());
+    }
+
+    // Prefetched chunks are not admitted beyond the byte limit, and never
+    // evict anything to make room.
+    {
+        auto cache(std::make_shared<Cache>(bytes / 2));
+        Reader(out, "", cache).prefetch(keys, projection);
+
+        const Cache::Stats prefetched(cache->stats());
+        EXPECT_EQ(prefetched.prefetches, keys.size());
+        EXPECT_GT(prefetched.rejections, 0u);
+        EXPECT_EQ(prefetched.evictions, 0u);
+        EXPECT_LE(prefetched.bytes, cache->maxBytes());
+
+        Reader r(out, "", cache);
+        auto q(r.read(j));
+        q->run();
+        EXPECT_EQ(q->data(), expected);
+        EXPECT_GT(cache->stats().hits, 0u);
+        EXPECT_GT(cache->stats().misses, 0u);
+    }
+}
+
+TEST(read, dimStats)
+{
+    DimStats added;
+    for (const double v : { 2.0, 5.0, 63.0 }) added.add(v);
+    ASSERT_TRUE(added.exact());
+
+    const DimStats exact(added.toJson());
+    EXPECT_TRUE(exact.exact());
+    EXPECT_EQ(exact.values(), added.values());
+    EXPECT_TRUE(exact.mayContain(5));
+    EXPECT_FALSE(exact.mayContain(4));
+    EXPECT_FALSE(exact.mayContain(5.5));
+
+    // Values which add could not have recorded make the stats inexact rather
+    // than being shifted out of range.
+    for (const Json::Value bad : { Json::Value(64), Json::Value(1000),
+                Json::Value(-1), Json::Value(2.5), Json::Value("2") })
+    {
+        Json::Value json(added.toJson());
+        json["values"].append(bad);
+
+        const DimStats stats(json);
+        EXPECT_FALSE(stats.exact()) << bad;
+        EXPECT_EQ(stats.values(), 0u) << bad;
+        EXPECT_TRUE(stats.mayContain(5)) << bad;
+        EXPECT_TRUE(stats.mayContain(4)) << bad;
+        EXPECT_FALSE(stats.mayContain(64)) << bad;
+    }
+
+    // Exact stats with an inconsistent range are still checked safely.
+    Json::Value json(added.toJson());
+    json["max"] = 1000;
+    const DimStats wide(json);
+    EXPECT_TRUE(wide.exact());
+    EXPECT_FALSE(wide.mayContain(100));
+    EXPECT_FALSE(wide.mayContain(64));
+}
+
+TEST(read, externalBuffers)
+{
+    splicer::BufferPool<char> pool(4, 16);
+
+    auto owner(std::make_shared<std::vector<char>>(12, 'x'));
+    char* data(owner->data());
+
+    {
+        auto external(pool.acquireExternal(data, 3, owner));
+        ASSERT_EQ(external.size(), 3u);
+        EXPECT_EQ(owner.use_count(), 2);
+        EXPECT_EQ(pool.used(), 3u);
+
+        // Releasing some of the nodes keeps the owner alive for the rest.
+        pool.release(external.popOne());
+        EXPECT_EQ(owner.use_count(), 2);
+        EXPECT_EQ(pool.used(), 2u);
+    }
+
+    // Released external nodes are never written or reused, and the owner is
+    // dropped once they have all been released.
+    EXPECT_EQ(owner.use_count(), 1);
+    EXPECT_EQ(pool.used(), 0u);
+    EXPECT_EQ(*owner, std::vector<char>(12, 'x'));
+
+    auto reused(pool.acquire(20));
+    for (const char* d : reused)
+    {
+        EXPECT_TRUE(d < data || d >= data + owner->size());
+    }
+}